@@ -0,0 +1,234 @@
+// Benchmarks for the shell's hot paths.
+//
+// Linked against libminishell so the lexer, parser and launch code are
+// timed directly, with no process boundary in the way. Results go to
+// stdout, or to -o file, as CSV or JSON lines so runs from different
+// builds can be diffed.
+//
+// Usage: bench [-q] [-f csv|json] [-o file]
+
+#include "../src/shell.h"
+
+#define BENCH_LINE_SIZE 8192
+#define BENCH_MAX_STAGES 64
+
+static FILE *bench_out;
+static int bench_json;
+static int bench_quick;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Emits one result row
+static void report(const char *bench, const char *variant, long iterations,
+                   double value, const char *unit) {
+    if (bench_json) {
+        fprintf(bench_out, "{\"bench\":\"%s\",\"variant\":\"%s\",\"iterations\":%ld,"
+                "\"value\":%.3f,\"unit\":\"%s\"}\n", bench, variant, iterations, value, unit);
+    } else {
+        fprintf(bench_out, "%s,%s,%ld,%.3f,%s\n", bench, variant, iterations, value, unit);
+    }
+    fflush(bench_out);
+}
+
+// Builds the synthetic input lines the lexer benchmark uses
+static void make_line(char *buf, size_t size, const char *kind) {
+    size_t len = 0;
+    int i;
+
+    buf[0] = '\0';
+    if (strcmp(kind, "args") == 0) {
+        // One command with many plain arguments
+        len += snprintf(buf + len, size - len, "printf");
+        for (i = 0; i < 200 && len < size - 16; i++) {
+            len += snprintf(buf + len, size - len, " arg%d", i);
+        }
+    } else if (strcmp(kind, "quotes") == 0) {
+        // Mixed quoting, including pieces glued into one word
+        len += snprintf(buf + len, size - len, "echo");
+        for (i = 0; i < 100 && len < size - 48; i++) {
+            len += snprintf(buf + len, size - len, " \"a b %d\" 'c|d' e\"f g\"'h'", i);
+        }
+    } else {
+        // A long pipeline with redirections at both ends
+        len += snprintf(buf + len, size - len, "cat < in.txt");
+        for (i = 0; i < BENCH_MAX_STAGES - 2 && len < size - 32; i++) {
+            len += snprintf(buf + len, size - len, " | grep -v 'x %d'", i);
+        }
+        snprintf(buf + len, size - len, " | sort >> out.txt");
+    }
+}
+
+// Lexing and parsing only: ns per line and MB/s of input
+static void bench_lexer(void) {
+    static const char *const kinds[] = { "args", "quotes", "pipes" };
+    char line[BENCH_LINE_SIZE];
+    arena_t a = { NULL };
+    long iters = bench_quick ? 2000 : 20000;
+
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+        token_list_t tl;
+        plan_t plan;
+        double start, elapsed;
+        size_t len;
+
+        make_line(line, sizeof(line), kinds[k]);
+        len = strlen(line);
+        start = now_sec();
+        for (long i = 0; i < iters; i++) {
+            if (lex_line(&a, line, &tl) != 0 || parse_line(&a, line, &tl, &plan) != 0) {
+                fprintf(stderr, "bench: %s line failed to parse\n", kinds[k]);
+                break;
+            }
+            arena_reset(&a);
+        }
+        elapsed = now_sec() - start;
+        report("lex_parse", kinds[k], iters, elapsed / iters * 1e9, "ns/line");
+        report("lex_parse", kinds[k], iters, (double)len * iters / elapsed / 1048576, "MB/s");
+    }
+    arena_destroy(&a);
+}
+
+// Runs line n times through the normal read-eval path; returns seconds
+static double time_lines(const char *line, long n) {
+    char buf[BENCH_LINE_SIZE];
+    double start = now_sec();
+
+    for (long i = 0; i < n; i++) {
+        // The line may be written into, so hand it a fresh copy
+        snprintf(buf, sizeof(buf), "%s", line);
+        ms_run_line(buf);
+    }
+    return now_sec() - start;
+}
+
+// Start-to-reap latency of one stage under each launch backend, plus the
+// per-stage cost inside an 8-stage pipeline
+static void bench_launch(void) {
+    long iters = bench_quick ? 100 : 1000;
+    int saved_mode = launch_mode;
+    int saved_fast = fastpath;
+
+    fastpath = 0;
+    for (int mode = 0; launch_names[mode]; mode++) {
+        double t;
+        launch_mode = mode;
+        t = time_lines("/bin/true", iters);
+        report("launch", launch_names[mode], iters, t / iters * 1e6, "us/stage");
+        t = time_lines("/bin/true | /bin/true | /bin/true | /bin/true | "
+                       "/bin/true | /bin/true | /bin/true | /bin/true", iters / 4);
+        report("launch_pipe8", launch_names[mode], iters / 4, t / (iters / 4) / 8 * 1e6, "us/stage");
+    }
+    launch_mode = saved_mode;
+
+    // The same single stage through the in-process path
+    fastpath = 1;
+    {
+        double t = time_lines("true", iters);
+        report("launch", "fastpath", iters, t / iters * 1e6, "us/stage");
+        t = time_lines("true | true | true | true | true | true | true | true", iters / 4);
+        report("launch_pipe8", "fastpath", iters / 4, t / (iters / 4) / 8 * 1e6, "us/stage");
+    }
+    fastpath = saved_fast;
+}
+
+// A small mixed script run end to end: commands per second
+static void bench_script(void) {
+    static const char *const script[] = {
+        "echo hello > /dev/null",
+        "cat /dev/null",
+        "true",
+        "printf '%s %d\\n' x 1 > /dev/null",
+        "ls / > /dev/null",
+        "echo a b c | cat | cat > /dev/null",
+        "cd /",
+        "cd /tmp",
+        "false",
+        "wc -c < /dev/null > /dev/null",
+    };
+    size_t nlines = sizeof(script) / sizeof(script[0]);
+    long rounds = bench_quick ? 20 : 200;
+    int saved_fast = fastpath;
+    char cwd[PATH_MAX];
+
+    if (!getcwd(cwd, sizeof(cwd))) cwd[0] = '\0';
+    for (int fast = 0; fast <= 1; fast++) {
+        double start, elapsed;
+        fastpath = fast;
+        start = now_sec();
+        for (long r = 0; r < rounds; r++) {
+            for (size_t i = 0; i < nlines; i++) time_lines(script[i], 1);
+        }
+        elapsed = now_sec() - start;
+        report("script", fast ? "fastpath" : "exec", rounds * (long)nlines,
+               rounds * (double)nlines / elapsed, "cmds/s");
+    }
+    fastpath = saved_fast;
+    if (cwd[0] && chdir(cwd) != 0) perror("bench: chdir");
+}
+
+// Streams zeros through 1 to BENCH_MAX_STAGES stages of cat: MB/s
+static void bench_throughput(void) {
+    long long bytes = bench_quick ? 64LL << 20 : 512LL << 20;
+    char line[BENCH_LINE_SIZE];
+
+    for (int stages = 1; stages <= BENCH_MAX_STAGES; stages *= 2) {
+        char variant[32];
+        size_t len;
+        double t;
+
+        // head is the first stage; the rest are cat
+        len = (size_t)snprintf(line, sizeof(line), "head -c %lld /dev/zero", bytes);
+        for (int i = 1; i < stages; i++) {
+            len += (size_t)snprintf(line + len, sizeof(line) - len, " | cat");
+        }
+        snprintf(line + len, sizeof(line) - len, " > /dev/null");
+
+        snprintf(variant, sizeof(variant), "%d", stages);
+        t = time_lines(line, 1);
+        report("pipe_throughput", variant, 1, (double)bytes / t / 1048576, "MB/s");
+    }
+}
+
+int main(int argc, char **argv) {
+    int opt;
+
+    bench_out = stdout;
+    while ((opt = getopt(argc, argv, "qf:o:")) != -1) {
+        switch (opt) {
+        case 'q':
+            bench_quick = 1;
+            break;
+        case 'f':
+            if (strcmp(optarg, "json") == 0) {
+                bench_json = 1;
+            } else if (strcmp(optarg, "csv") != 0) {
+                fprintf(stderr, "bench: unknown format '%s'\n", optarg);
+                return 2;
+            }
+            break;
+        case 'o':
+            bench_out = fopen(optarg, "w");
+            if (!bench_out) {
+                fprintf(stderr, "bench: cannot open '%s'. %s.\n", optarg, strerror(errno));
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: bench [-q] [-f csv|json] [-o file]\n");
+            return 2;
+        }
+    }
+
+    if (!bench_json) fprintf(bench_out, "bench,variant,iterations,value,unit\n");
+    bench_lexer();
+    bench_launch();
+    bench_script();
+    bench_throughput();
+
+    if (bench_out != stdout) fclose(bench_out);
+    return 0;
+}
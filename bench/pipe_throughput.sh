@@ -0,0 +1,44 @@
+#!/bin/sh
+# Pushes a multi-GB stream through a few stages under different pipe
+# settings and prints the wall time and throughput of each run.
+#
+# Usage: bench/pipe_throughput.sh [GiB] [stages]
+# Set MINISHELL to test a different binary (default: src/minishell).
+
+GIB=${1:-4}
+STAGES=${2:-4}
+SHELL_BIN=${MINISHELL:-$(dirname "$0")/../src/minishell}
+BYTES=$((GIB * 1024 * 1024 * 1024))
+
+# head | cat | ... | cat > /dev/null
+pipeline="head -c $BYTES /dev/zero"
+i=1
+while [ "$i" -lt "$STAGES" ]; do
+    pipeline="$pipeline | cat"
+    i=$((i + 1))
+done
+pipeline="$pipeline > /dev/null"
+
+run() {
+    label=$1
+    shift
+    script=""
+    for opt in "$@"; do
+        script="${script}set -o $opt
+"
+    done
+    start=$(date +%s.%N)
+    printf '%s%s\n' "$script" "$pipeline" | "$SHELL_BIN"
+    end=$(date +%s.%N)
+    echo "$label $start $end" | awk -v bytes="$BYTES" '{
+        t = $3 - $2
+        printf "%-28s %8.3fs %10.1f MB/s\n", $1, t, bytes / t / 1048576
+    }'
+}
+
+echo "$GIB GiB through $STAGES stages"
+run default
+run pipesize=256K        pipesize=256K
+run pipesize=1M          pipesize=1M
+run pipesize=1M,direct   pipesize=1M pipedirect
+run exec-cat,1M          pipesize=1M "fastpath=off"
@@ -0,0 +1,256 @@
+// Public entry points declared in minishell.h
+
+#include "shell.h"
+
+// A parsed line handed out through the public API; owns its memory
+struct ms_plan {
+    arena_t arena;
+    plan_t plan;
+};
+
+volatile sig_atomic_t interrupted = 0;
+volatile sig_atomic_t child_exited = 0;
+int sigchld_wakeup = -1;        // Pipe the handler pokes for --serve's epoll loop
+int last_status;
+static arena_t line_arena;
+
+static void handle_sigint(int sig) {
+    (void)sig;
+    interrupted = 1;
+    write(STDOUT_FILENO, "\n", 1);
+}
+
+// Children are reaped from the main loop, not from the handler
+static void handle_sigchld(int sig) {
+    (void)sig;
+    child_exited = 1;
+    if (sigchld_wakeup != -1) {
+        int saved = errno;
+        write(sigchld_wakeup, "", 1);
+        errno = saved;
+    }
+}
+
+int ms_init(int flags) {
+    struct sigaction sa;
+    sa.sa_handler = handle_sigint;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+
+    if (sigaction(SIGINT, &sa, NULL) == -1) {
+        fprintf(stderr, "Error: Cannot register signal handler. %s.\n",
+                strerror(errno));
+        return -1;
+    }
+    sa.sa_handler = handle_sigchld;
+    if (sigaction(SIGCHLD, &sa, NULL) == -1) {
+        fprintf(stderr, "Error: Cannot register signal handler. %s.\n",
+                strerror(errno));
+        return -1;
+    }
+
+    // Job control: the shell leads its own process group and hands the
+    // terminal to whichever job is in the foreground
+    if (flags & MS_INTERACTIVE) {
+        while (tcgetpgrp(STDIN_FILENO) != (shell_pgid = getpgrp())) {
+            kill(-shell_pgid, SIGTTIN);
+        }
+        signal(SIGTSTP, SIG_IGN);
+        signal(SIGTTIN, SIG_IGN);
+        signal(SIGTTOU, SIG_IGN);
+        shell_pgid = getpid();
+        if (setpgid(0, shell_pgid) == 0 || errno == EPERM) {
+            shell_pgid = getpgrp();
+            tcsetpgrp(STDIN_FILENO, shell_pgid);
+            tcgetattr(STDIN_FILENO, &shell_tmodes);
+            job_control = 1;
+        }
+    }
+    return 0;
+}
+
+// Copies a `sched` prefix into a; NULL stays NULL
+static int copy_sched(arena_t *a, sched_t **sched) {
+    sched_t *s;
+
+    if (!*sched) return 0;
+    if (!(s = (sched_t *)arena_alloc(a, sizeof(*s)))) return -1;
+    *s = **sched;
+    if (s->cpus) {
+        if (!(s->cpus = (cpu_set_t *)arena_alloc(a, sizeof(cpu_set_t)))) return -1;
+        *s->cpus = *(*sched)->cpus;
+    }
+    *sched = s;
+    return 0;
+}
+
+// Copies the string *s into a; NULL stays NULL
+static int copy_string(arena_t *a, const char **s) {
+    char *copy;
+
+    if (!*s) return 0;
+    if (!(copy = (char *)arena_alloc(a, strlen(*s) + 1))) return -1;
+    *s = strcpy(copy, *s);
+    return 0;
+}
+
+// Copies a step's pipeline and source text into a, so a job can take a
+// over without taking the rest of the plan with it. Every string goes
+// along: the line's arena is reset while a background job still runs.
+static pipeline_t *copy_pipeline(arena_t *a, const pipeline_t *src, const char **cmdline) {
+    pipeline_t *pl = (pipeline_t *)arena_alloc(a, sizeof(*pl));
+
+    if (!pl || copy_string(a, cmdline) != 0) return NULL;
+    *pl = *src;
+    pl->cmds = (command_t *)arena_alloc(a, (size_t)src->num_cmds * sizeof(command_t));
+    if (!pl->cmds || copy_sched(a, &pl->sched) != 0) return NULL;
+    for (int i = 0; i < src->num_cmds; i++) {
+        command_t *cmd = &pl->cmds[i];
+        *cmd = src->cmds[i];
+        cmd->args = (char **)arena_alloc(a, ((size_t)cmd->num_args + 1) * sizeof(char *));
+        if (!cmd->args || copy_sched(a, &cmd->sched) != 0 ||
+            copy_string(a, &cmd->path) != 0) {
+            return NULL;
+        }
+        for (int j = 0; j <= cmd->num_args; j++) {
+            cmd->args[j] = src->cmds[i].args[j];
+            if (copy_string(a, (const char **)&cmd->args[j]) != 0) return NULL;
+        }
+        for (int j = 0; j < cmd->num_redirs; j++) {
+            redir_t *r = &cmd->redirs[j];
+            if (copy_string(a, (const char **)&r->file) != 0 ||
+                copy_string(a, (const char **)&r->here) != 0) {
+                return NULL;
+            }
+        }
+        if (cmd->num_fanout) {
+            cmd->fanout = (char **)arena_alloc(a, (size_t)cmd->num_fanout * sizeof(char *));
+            if (!cmd->fanout) return NULL;
+        }
+        for (int j = 0; j < cmd->num_fanout; j++) {
+            cmd->fanout[j] = src->cmds[i].fanout[j];
+            if (copy_string(a, (const char **)&cmd->fanout[j]) != 0) return NULL;
+        }
+    }
+    return pl;
+}
+
+// Runs one step: a lone builtin in the shell, anything else as a job.
+// With shared set the plan arena a still holds later steps, so a job
+// that may outlive the line gets a copy of its own.
+static int run_step(arena_t *a, plan_step_t *step, int shared) {
+    pipeline_t *pl = &step->pipeline;
+    const char *cmdline = step->cmdline;
+    arena_t own = { NULL };
+
+    if (expand_pipeline(a, pl) != 0) return last_status = 1;
+    if (pl->num_cmds == 1 && run_builtin(&pl->cmds[0], &last_status)) {
+        set_pipe_status(&last_status, 1);
+        return last_status;
+    }
+    if (shared) {
+        pl = copy_pipeline(&own, pl, &cmdline);
+        if (!pl) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            arena_destroy(&own);
+            return last_status = 1;
+        }
+        a = &own;
+    }
+    execute_pipeline(a, pl, cmdline);
+    // Empty if the job took it over
+    arena_destroy(&own);
+    return last_status;
+}
+
+// Runs a plan whose memory lives in a, following each step's jumps.
+// A pipeline killed by ^C abandons the rest of the line, as in bash.
+static int run_plan(arena_t *a, plan_t *plan) {
+    int i = 0;
+
+    while (i < plan->num_steps) {
+        const plan_step_t *step = &plan->steps[i];
+        if (run_step(a, &plan->steps[i], plan->num_steps > 1) == 128 + SIGINT) break;
+        i = last_status == 0 ? step->on_success : step->on_failure;
+    }
+    return last_status;
+}
+
+// Parses and runs one input line
+int ms_run_line(const char *line) {
+    token_list_t tokens;
+    plan_t plan;
+
+    if (lex_line(&line_arena, line, &tokens) == 0 &&
+        parse_line(&line_arena, line, &tokens, &plan) == 0) {
+        run_plan(&line_arena, &plan);
+    } else {
+        last_status = 2;
+    }
+
+    // Tokens, argv arrays and the plan all go away together
+    arena_reset(&line_arena);
+    return last_status;
+}
+
+ms_plan_t *ms_parse(const char *line) {
+    ms_plan_t *p = (ms_plan_t *)calloc(1, sizeof(ms_plan_t));
+    token_list_t tokens;
+
+    if (!p) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return NULL;
+    }
+    // Words and each step's source text are copied into the plan's arena
+    if (lex_line(&p->arena, line, &tokens) != 0 ||
+        parse_line(&p->arena, line, &tokens, &p->plan) != 0) {
+        ms_plan_free(p);
+        return NULL;
+    }
+    return p;
+}
+
+int ms_plan_stages(const ms_plan_t *plan) {
+    int n = 0;
+    for (int i = 0; i < plan->plan.num_steps; i++) n += plan->plan.steps[i].pipeline.num_cmds;
+    return n;
+}
+
+int ms_run(ms_plan_t *plan) {
+    int rc = run_plan(&plan->arena, &plan->plan);
+    ms_plan_free(plan);
+    return rc;
+}
+
+void ms_plan_free(ms_plan_t *plan) {
+    if (!plan) return;
+    // A job that outlived the call has already taken the arena over
+    arena_destroy(&plan->arena);
+    free(plan);
+}
+
+int ms_status(void) {
+    return last_status;
+}
+
+int ms_set_option(const char *spec) {
+    return set_option(spec, 1);
+}
+
+int ms_trace(const char *path) {
+    return trace_open(path);
+}
+
+void ms_notify_jobs(void) {
+    notify_jobs();
+}
+
+int ms_interrupted(void) {
+    if (!interrupted) return 0;
+    interrupted = 0;
+    return 1;
+}
+
+int ms_run_batch(ms_reader_t *r, int njobs, int keep_order) {
+    return run_batch(r, njobs, keep_order);
+}
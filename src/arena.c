@@ -0,0 +1,85 @@
+// Per-line bump allocator
+
+#include "shell.h"
+
+#define ARENA_ROUND(N) (((N) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define ARENA_HDR ARENA_ROUND(sizeof(arena_chunk_t))
+
+// Returns n bytes from the arena, NULL when out of memory
+void *arena_alloc(arena_t *a, size_t n) {
+    arena_chunk_t *c = a->head;
+    void *p;
+
+    n = ARENA_ROUND(n ? n : 1);
+    if (!c || c->size - c->used < n) {
+        size_t size = n > ARENA_CHUNK_SIZE ? n : ARENA_CHUNK_SIZE;
+        c = (arena_chunk_t *)malloc(ARENA_HDR + size);
+        if (!c) return NULL;
+        c->next = a->head;
+        c->size = size;
+        c->used = 0;
+        a->head = c;
+    }
+    p = (char *)c + ARENA_HDR + c->used;
+    c->used += n;
+    return p;
+}
+
+// Grows a buffer for arena_adopt to at least need bytes; buf is NULL to
+// start one, *cap its current size. Data read straight into it never
+// has to be copied into the arena. Returns NULL when out of memory, with
+// the old buffer left alone.
+char *arena_buffer_grow(char *buf, size_t *cap, size_t need) {
+    arena_chunk_t *c = buf ? (arena_chunk_t *)(buf - ARENA_HDR) : NULL;
+    size_t size = *cap ? *cap : ARENA_CHUNK_SIZE;
+
+    while (size < need) size *= 2;
+    if (c && size == *cap) return buf;
+    c = (arena_chunk_t *)realloc(c, ARENA_HDR + size);
+    if (!c) return NULL;
+    *cap = size;
+    return (char *)c + ARENA_HDR;
+}
+
+// Frees a buffer from arena_buffer_grow that was never adopted
+void arena_buffer_free(char *buf) {
+    if (buf) free(buf - ARENA_HDR);
+}
+
+// Makes a buffer from arena_buffer_grow part of the arena, to be freed
+// with it. It goes in as a full chunk behind the current one, which
+// keeps serving arena_alloc.
+void arena_adopt(arena_t *a, char *buf, size_t cap) {
+    arena_chunk_t *c = (arena_chunk_t *)(buf - ARENA_HDR);
+
+    c->size = cap;
+    c->used = cap;
+    if (!a->head) {
+        c->next = NULL;
+        a->head = c;
+        return;
+    }
+    c->next = a->head->next;
+    a->head->next = c;
+}
+
+// Drops everything allocated since the last reset. The oldest chunk is
+// kept so steady-state lines never touch malloc.
+void arena_reset(arena_t *a) {
+    arena_chunk_t *c = a->head;
+    if (!c) return;
+    while (c->next) {
+        arena_chunk_t *next = c->next;
+        free(c);
+        c = next;
+    }
+    c->used = 0;
+    a->head = c;
+}
+
+// Releases every chunk; the arena can be reused afterwards
+void arena_destroy(arena_t *a) {
+    arena_reset(a);
+    free(a->head);
+    a->head = NULL;
+}
@@ -0,0 +1,284 @@
+// Batch mode (-j): independent lines run in parallel
+
+#include "shell.h"
+
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/wait.h>
+
+// One in-flight command line in batch (-j) mode
+typedef struct {
+    arena_t arena;      // Holds the plan until its last job is reaped
+    plan_t plan;
+    int step;           // Step of the plan running or about to run
+    job_t job;
+    long seq;           // Input order, for -k
+    int out_fd;         // memfd capturing stdout under -k, else -1
+    int busy;
+    int forked;         // The whole line runs in a copy of the shell
+} batch_slot_t;
+
+// Copies a finished -k job's captured output to stdout and drops it
+static void flush_capture(int fd) {
+    off_t off = 0;
+    ssize_t n;
+
+    // sendfile moves the bytes without a round trip through user space
+    while ((n = sendfile(STDOUT_FILENO, fd, &off, 1 << 30)) > 0) {}
+    if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+        char buf[READ_CHUNK_SIZE];
+        while ((n = pread(fd, buf, sizeof(buf), off)) > 0) {
+            if (write(STDOUT_FILENO, buf, (size_t)n) != n) break;
+            off += n;
+        }
+    }
+    close(fd);
+}
+
+// Batch mode state: slots in flight plus -k output parked until its turn
+typedef struct {
+    batch_slot_t *slots;
+    int nslots;
+    int running;
+    int keep_order;
+    long next_seq;      // Input order number to assign next
+    long flush_seq;     // Next job whose output goes to stdout under -k
+    int *parked;        // Captured output fds, indexed by seq % parked_cap
+    long parked_cap;
+} batch_t;
+
+// Grows the -k ring so seq fits; returns -1 when out of memory
+static int batch_reserve(batch_t *b, long seq) {
+    long cap = b->parked_cap ? b->parked_cap : 64;
+    int *ring;
+
+    if (seq - b->flush_seq < b->parked_cap) return 0;
+    while (seq - b->flush_seq >= cap) cap *= 2;
+    ring = (int *)malloc((size_t)cap * sizeof(int));
+    if (!ring) return -1;
+    for (long i = 0; i < cap; i++) ring[i] = -1;
+    for (long s = b->flush_seq; s < b->flush_seq + b->parked_cap; s++) {
+        ring[s % cap] = b->parked[s % b->parked_cap];
+    }
+    free(b->parked);
+    b->parked = ring;
+    b->parked_cap = cap;
+    return 0;
+}
+
+// Runs the slot's plan from its current step until a job is left running
+// or the plan is done; returns 1 in the first case. Lines with builtins
+// go through batch_fork instead. $? in a step is the status of the step before
+// it in the same line, so last_status is set as each step ends.
+static int batch_advance(batch_slot_t *slot) {
+    while (slot->step < slot->plan.num_steps) {
+        plan_step_t *step = &slot->plan.steps[slot->step];
+        pipeline_t *pl = &step->pipeline;
+        int std_fds[3] = { -1, slot->out_fd, -1 };
+        int status;
+
+        if (expand_pipeline(&slot->arena, pl) != 0) {
+            status = 1;
+        } else if (launch_pipeline(&slot->arena, pl, std_fds, &slot->job) != 0) {
+            status = 1;
+        } else if (slot->job.nalive > 0) {
+            job_register(&slot->job, 0);
+            return 1;
+        } else {
+            if (pl->timed != TIME_NONE) report_times(&slot->job);
+            status = job_result(&slot->job);
+            set_pipe_status(slot->job.statuses, pl->num_cmds);
+        }
+        last_status = status;
+        slot->step = status == 0 ? step->on_success : step->on_failure;
+    }
+    return 0;
+}
+
+// Whether a step of plan may run a builtin, which would act on the shell
+// every slot shares. A command name that is still to be expanded could
+// turn out to be one.
+static int uses_builtins(const plan_t *plan) {
+    for (int i = 0; i < plan->num_steps; i++) {
+        const pipeline_t *pl = &plan->steps[i].pipeline;
+        const char *name = pl->cmds[0].args[0];
+        if (pl->num_cmds == 1 && (is_builtin(name) || strchr(name, PARAM_MARK))) return 1;
+    }
+    return 0;
+}
+
+// Runs line in a copy of the shell, so a cd or variable set on it stays
+// with that line and anything it prints goes where the slot's output
+// goes, -k ring included. The slot's job is that one process. Returns
+// 0 if it started.
+static int batch_fork(batch_slot_t *slot, const char *line) {
+    job_t *job = &slot->job;
+    pipeline_t *pl = (pipeline_t *)arena_alloc(&slot->arena, sizeof(*pl));
+    pid_t pid;
+
+    memset(job, 0, sizeof(*job));
+    job->pids = (pid_t *)arena_alloc(&slot->arena, sizeof(pid_t));
+    job->stopped = (unsigned char *)arena_alloc(&slot->arena, 1);
+    job->statuses = (int *)arena_alloc(&slot->arena, sizeof(int));
+    if (!pl || !job->pids || !job->stopped || !job->statuses) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return -1;
+    }
+    // Stands in for the line; a status of 127 checks no cached path
+    *pl = slot->plan.steps[0].pipeline;
+    pl->num_cmds = 1;
+    pl->timed = TIME_NONE;
+
+    fflush(NULL);
+    pid = fork();
+    if (pid == 0) {
+        signal(SIGINT, SIG_DFL);
+        if (slot->out_fd != -1) dup2(slot->out_fd, STDOUT_FILENO);
+        job_control = 0;
+        job_table = NULL;
+        ms_run_line(line);
+        fflush(stdout);
+        _exit(last_status);
+    }
+    if (pid < 0) {
+        fprintf(stderr, "Error: fork() failed. %s.\n", strerror(errno));
+        return -1;
+    }
+    job->plan = pl;
+    job->pids[0] = pid;
+    job->stopped[0] = 0;
+    job->statuses[0] = 0;
+    job->nprocs = 1;
+    job->nalive = 1;
+    job->failed = -1;
+    job_register(job, 0);
+    slot->forked = 1;
+    return 0;
+}
+
+// Retires a finished slot, emitting any -k output that is now in order
+static void batch_finish(batch_t *b, batch_slot_t *slot) {
+    slot->busy = 0;
+    b->running--;
+    arena_reset(&slot->arena);
+    if (!b->keep_order) return;
+
+    b->parked[slot->seq % b->parked_cap] = slot->out_fd;
+    while (b->flush_seq < b->next_seq && b->parked[b->flush_seq % b->parked_cap] != -1) {
+        long idx = b->flush_seq % b->parked_cap;
+        flush_capture(b->parked[idx]);
+        b->parked[idx] = -1;
+        b->flush_seq++;
+    }
+}
+
+// Moves on every slot whose job has no stages left. Slots are found by
+// scanning rather than by the pid just reaped: a `wait` or `jobs` line
+// reaps through the job table too, and may have finished a slot's job.
+// Returns how many jobs were done.
+static int batch_collect(batch_t *b) {
+    int done = 0;
+
+    for (int i = 0; i < b->nslots; i++) {
+        batch_slot_t *slot = &b->slots[i];
+        job_t *job = &slot->job;
+        const plan_step_t *step;
+        if (!slot->busy || job->nalive > 0) continue;
+
+        done++;
+        job_unregister(job);
+        if (job->plan->timed != TIME_NONE) report_times(job);
+        step = &slot->plan.steps[slot->step];
+        last_status = job_result(job);
+        set_pipe_status(job->statuses, job->plan->num_cmds);
+        slot->step = slot->forked ? slot->plan.num_steps :
+                     last_status == 0 ? step->on_success : step->on_failure;
+        if (!batch_advance(slot)) batch_finish(b, slot);
+    }
+    return done;
+}
+
+// Waits until some slot's job is done; returns -1 when nothing is left
+// to reap
+static int batch_reap(batch_t *b) {
+    int status;
+    job_t *job;
+
+    if (batch_collect(b) > 0) return 0;
+    if (reap_child(0, &status, &job) == -1 && errno != EINTR) return -1;
+    batch_collect(b);
+    return 0;
+}
+
+// Batch mode: every input line is an independent job and up to njobs of
+// them run at once. Output goes straight through as jobs write it, or is
+// captured per job and emitted in input order with -k.
+int run_batch(line_reader_t *reader, int njobs, int keep_order) {
+    batch_t b;
+    char *line;
+    int lost = 0;
+    int rc;
+
+    memset(&b, 0, sizeof(b));
+    b.nslots = njobs;
+    b.keep_order = keep_order;
+    b.slots = (batch_slot_t *)calloc((size_t)njobs, sizeof(batch_slot_t));
+    if (!b.slots) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return EXIT_FAILURE;
+    }
+
+    while ((rc = read_command(reader, &line)) > 0) {
+        batch_slot_t *slot = NULL;
+        token_list_t tokens;
+
+        if (line[0] == '\0') continue;
+        while (b.running == b.nslots) {
+            if (batch_reap(&b) < 0) break;
+        }
+        for (int i = 0; i < b.nslots && !slot; i++) {
+            if (!b.slots[i].busy) slot = &b.slots[i];
+        }
+        if (!slot) {
+            // Every slot waits on stages that are no longer our children
+            fprintf(stderr, "Error: Lost track of running jobs. %s.\n", strerror(errno));
+            lost = 1;
+            break;
+        }
+
+        if (lex_line(&slot->arena, line, &tokens) != 0 ||
+            parse_line(&slot->arena, line, &tokens, &slot->plan) != 0 ||
+            slot->plan.num_steps == 0) {
+            arena_reset(&slot->arena);
+            continue;
+        }
+        slot->out_fd = -1;
+        if (keep_order) {
+            if (batch_reserve(&b, b.next_seq) != 0 ||
+                (slot->out_fd = memfd_create("minishell-batch", MFD_CLOEXEC)) == -1) {
+                fprintf(stderr, "Error: Cannot capture job output. %s.\n", strerror(errno));
+                arena_reset(&slot->arena);
+                continue;
+            }
+        }
+        slot->seq = b.next_seq++;
+        slot->step = 0;
+        slot->busy = 1;
+        slot->forked = 0;
+        b.running++;
+        if (uses_builtins(&slot->plan) ? batch_fork(slot, line) != 0 : !batch_advance(slot)) {
+            batch_finish(&b, slot);
+        }
+    }
+    if (rc < 0) {
+        fprintf(stderr, "Error: Failed to read input. %s.\n", strerror(errno));
+    }
+
+    while (b.running > 0) {
+        if (batch_reap(&b) < 0) break;
+    }
+    for (int i = 0; i < b.nslots; i++) arena_destroy(&b.slots[i].arena);
+    free(b.parked);
+    free(b.slots);
+    return rc < 0 || lost ? EXIT_FAILURE : EXIT_SUCCESS;
+}
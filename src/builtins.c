@@ -0,0 +1,489 @@
+// Builtins and `set -o` options
+
+#include "shell.h"
+
+#include <fcntl.h>
+#include <pwd.h>
+#include <sys/wait.h>
+
+const char *const launch_names[] = { "fork", "vfork", "spawn", NULL };
+const char *const onoff_names[] = { "off", "on", NULL };
+const char *const affinity_names[] = { "off", "spread", NULL };
+
+static char prev_dir[PATH_MAX] = "";
+
+static const shell_option_t shell_options[] = {
+    { "launch",   &launch_mode, launch_names },
+    { "fastpath", &fastpath,    onoff_names },
+    { "pipesize", &pipe_size,   NULL },
+    { "pipedirect", &pipe_direct, onoff_names },
+    { "pipefail", &pipefail,    onoff_names },
+    { "failfast", &failfast,    onoff_names },
+    { "stderrtag", &stderr_tag, onoff_names },
+    { "xargs",    &xargs_split, onoff_names },
+    { "affinity", &affinity_mode, affinity_names },
+};
+
+// Finds a job by "%n", "n" or, with no argument, the most recent one
+static job_t *find_job(const char *builtin, const char *spec) {
+    job_t *job;
+    job_t *last = NULL;
+    char *endp;
+    long id;
+
+    for (job = job_table; job; job = job->next) {
+        if (job->id) last = job;
+    }
+    if (!spec) {
+        if (!last) fprintf(stderr, "%s: current: no such job\n", builtin);
+        return last;
+    }
+
+    id = strtol(spec[0] == '%' ? spec + 1 : spec, &endp, 10);
+    for (job = job_table; *endp == '\0' && job; job = job->next) {
+        if (job->id && job->id == id) return job;
+    }
+    fprintf(stderr, "%s: %s: no such job\n", builtin, spec);
+    return NULL;
+}
+
+// Builtin: jobs
+static int builtin_jobs(const command_t *cmd) {
+    (void)cmd;
+    reap_jobs();
+    for (job_t *job = job_table; job; job = job->next) {
+        if (job->id) print_job(job);
+    }
+    fflush(stdout);
+    notify_jobs();
+    return 0;
+}
+
+// True while job, or any tracked job when job is NULL, has running stages
+static int jobs_running(const job_t *job) {
+    if (job) return job->nalive > job->nstopped;
+    for (job = job_table; job; job = job->next) {
+        if (job->id && job->nalive > job->nstopped) return 1;
+    }
+    return 0;
+}
+
+// Builtin: wait [%n...]; the status is that of the last job named
+static int builtin_wait(const command_t *cmd) {
+    int rc = 0;
+
+    for (int i = 1; i < cmd->num_args || i == 1; i++) {
+        job_t *job = NULL;
+        if (i < cmd->num_args && !(job = find_job("wait", cmd->args[i]))) {
+            rc = 127;
+            continue;
+        }
+
+        while (jobs_running(job)) {
+            int status;
+            job_t *owner;
+            if (reap_child(WUNTRACED, &status, &owner) == -1) {
+                if (errno == EINTR && !interrupted) continue;
+                break;
+            }
+        }
+        if (job) rc = job->nalive == 0 ? job_result(job) : 128 + SIGTSTP;
+    }
+    notify_jobs();
+    return rc;
+}
+
+// Builtin: fg [%n]
+static int builtin_fg(const command_t *cmd) {
+    job_t *job;
+
+    if (!job_control) {
+        fprintf(stderr, "fg: no job control\n");
+        return 1;
+    }
+    job = find_job("fg", cmd->num_args > 1 ? cmd->args[1] : NULL);
+    if (!job) return 1;
+
+    printf("%s\n", job->cmdline);
+    fflush(stdout);
+    tcsetpgrp(STDIN_FILENO, job->pgid);
+    kill(-job->pgid, SIGCONT);
+    for (int i = 0; i < job->nprocs; i++) job->stopped[i] = 0;
+    job->nstopped = 0;
+    foreground_job(job);
+    return last_status;
+}
+
+// Builtin: bg [%n]
+static int builtin_bg(const command_t *cmd) {
+    job_t *job;
+
+    if (!job_control) {
+        fprintf(stderr, "bg: no job control\n");
+        return 1;
+    }
+    job = find_job("bg", cmd->num_args > 1 ? cmd->args[1] : NULL);
+    if (!job) return 1;
+
+    kill(-job->pgid, SIGCONT);
+    job->background = 1;
+    printf("[%d]%c %s &\n", job->id, job->next ? ' ' : '+', job->cmdline);
+    fflush(stdout);
+    return 0;
+}
+
+// Builtin: exit [n]
+static int builtin_exit(const command_t *cmd) {
+    if (cmd->num_args == 1) {
+        exit(last_status);
+    } else if (cmd->num_args == 2) {
+        char *endp = NULL;
+        long val;
+        errno = 0;
+        val = strtol(cmd->args[1], &endp, 10);
+        if (errno != 0 || endp == cmd->args[1] || *endp != '\0') {
+            fprintf(stderr, "exit: %s: numeric argument required\n", cmd->args[1]);
+            exit(2);
+        }
+        exit((int)val);
+    }
+    fprintf(stderr, "exit: too many arguments\n");
+    return 1;
+}
+
+// Builtin: cd [dir | - | ~]
+static int builtin_cd(const command_t *cmd) {
+    int rc = 0;
+
+    if (cmd->num_args == 1 || (cmd->num_args == 2 && strcmp(cmd->args[1], "~") == 0)) {
+        struct passwd *pw = getpwuid(getuid());
+        if (!pw) {
+            fprintf(stderr, "Error: Cannot resolve home directory. %s.\n", strerror(errno));
+            return 1;
+        }
+        char old[PATH_MAX];
+        if (!getcwd(old, sizeof(old))) old[0] = '\0';
+
+        rc = chdir(pw->pw_dir);
+        if (rc != 0) {
+            fprintf(stderr, "Error: Cannot change directory to home. %s.\n", strerror(errno));
+        } else if (old[0]) {
+            strncpy(prev_dir, old, sizeof(prev_dir));
+            prev_dir[sizeof(prev_dir)-1] = '\0';
+        }
+        return rc != 0;
+    }
+
+    if (cmd->num_args > 2) {
+        fprintf(stderr, "cd: too many arguments\n");
+        return 1;
+    }
+
+    const char *arg_in = cmd->args[1];
+
+    if (strcmp(arg_in, "-") == 0) {
+        if (prev_dir[0] == '\0') {
+            fprintf(stderr, "cd: OLDPWD not set\n");
+            return 1;
+        }
+        char old[PATH_MAX];
+        if (!getcwd(old, sizeof(old))) old[0] = '\0';
+
+        rc = chdir(prev_dir);
+        if (rc != 0) {
+            fprintf(stderr, "Error: Cannot change directory to '%s'. %s.\n", prev_dir, strerror(errno));
+        } else {
+            printf("%s\n", prev_dir);
+            fflush(stdout);
+            if (old[0]) {
+                strncpy(prev_dir, old, sizeof(prev_dir));
+                prev_dir[sizeof(prev_dir)-1] = '\0';
+            }
+        }
+        return rc != 0;
+    }
+
+    char target[PATH_MAX];
+    if (arg_in[0] == '~') {
+        struct passwd *pw = getpwuid(getuid());
+        if (!pw) {
+            fprintf(stderr, "Error: Cannot resolve home directory. %s.\n", strerror(errno));
+            return 1;
+        }
+        snprintf(target, sizeof(target), "%s%s", pw->pw_dir, arg_in + 1);
+    } else {
+        snprintf(target, sizeof(target), "%s", arg_in);
+    }
+
+    char old[PATH_MAX];
+    if (!getcwd(old, sizeof(old))) old[0] = '\0';
+
+    rc = chdir(target);
+    if (rc != 0) {
+        fprintf(stderr, "Error: Cannot change directory to '%s'. %s.\n", target, strerror(errno));
+    } else if (old[0]) {
+        strncpy(prev_dir, old, sizeof(prev_dir));
+        prev_dir[sizeof(prev_dir)-1] = '\0';
+    }
+    return rc != 0;
+}
+
+// Looks up a `set -o` option by name
+static const shell_option_t *find_option(const char *name, size_t len) {
+    size_t i;
+    for (i = 0; i < sizeof(shell_options) / sizeof(shell_options[0]); i++) {
+        if (strlen(shell_options[i].name) == len &&
+            strncmp(shell_options[i].name, name, len) == 0) {
+            return &shell_options[i];
+        }
+    }
+    return NULL;
+}
+
+// Sets an option from "name=value"; returns -1 on a bad name or value.
+// A bare name turns an on/off option on (-o) or off (+o).
+int set_option(const char *spec, int on) {
+    const char *eq = strchr(spec, '=');
+    size_t len = eq ? (size_t)(eq - spec) : strlen(spec);
+    const shell_option_t *opt = find_option(spec, len);
+    int i;
+
+    if (!opt) {
+        fprintf(stderr, "set: %.*s: invalid option name\n", (int)len, spec);
+        return -1;
+    }
+    if (!eq && opt->choices == onoff_names) {
+        *opt->value = on;
+        return 0;
+    }
+    if (!eq || !on) {
+        fprintf(stderr, "set: %s: option requires a value\n", opt->name);
+        return -1;
+    }
+    if (!opt->choices) {
+        // Sizes take an optional K or M suffix
+        char *end;
+        long long v = strtoll(eq + 1, &end, 10);
+        if (*end == 'K' || *end == 'k') {
+            v *= 1024;
+            end++;
+        } else if (*end == 'M' || *end == 'm') {
+            v *= 1024 * 1024;
+            end++;
+        }
+        if (end == eq + 1 || *end || v < 0 || v > INT_MAX) {
+            fprintf(stderr, "set: %s: invalid value for %s\n", eq + 1, opt->name);
+            return -1;
+        }
+        *opt->value = (int)v;
+        return 0;
+    }
+    for (i = 0; opt->choices[i]; i++) {
+        if (strcmp(opt->choices[i], eq + 1) == 0) {
+            *opt->value = i;
+            return 0;
+        }
+    }
+    fprintf(stderr, "set: %s: invalid value for %s\n", eq + 1, opt->name);
+    return -1;
+}
+
+// Builtin: set [-o [name=value]] [-o|+o name]
+static int builtin_set(const command_t *cmd) {
+    size_t i;
+
+    if (cmd->num_args == 1 || (cmd->num_args == 2 && strcmp(cmd->args[1], "-o") == 0)) {
+        for (i = 0; i < sizeof(shell_options) / sizeof(shell_options[0]); i++) {
+            const shell_option_t *opt = &shell_options[i];
+            if (opt->choices) {
+                printf("%-15s%s\n", opt->name, opt->choices[*opt->value]);
+            } else if (opt->value == &pipe_size && pipe_granted) {
+                printf("%-15s%d (last pipe got %d)\n", opt->name, *opt->value, pipe_granted);
+            } else {
+                printf("%-15s%d\n", opt->name, *opt->value);
+            }
+        }
+        fflush(stdout);
+        return 0;
+    }
+    for (int j = 1; j < cmd->num_args; j++) {
+        int on = strcmp(cmd->args[j], "-o") == 0;
+        if ((!on && strcmp(cmd->args[j], "+o") != 0) || j + 1 >= cmd->num_args) {
+            fprintf(stderr, "set: usage: set [-o name[=value]] [+o name]...\n");
+            return 2;
+        }
+        if (set_option(cmd->args[++j], on) != 0) return 1;
+    }
+    return 0;
+}
+
+// Builtin: hash [-r] [name...]
+static int builtin_hash(const command_t *cmd) {
+    int rc = 0;
+    int i;
+
+    if (cmd->num_args == 1) {
+        if (path_cache_list() == 0) printf("hash: hash table empty\n");
+        fflush(stdout);
+        return 0;
+    }
+
+    for (i = 1; i < cmd->num_args; i++) {
+        const char *name = cmd->args[i];
+        if (strcmp(name, "-r") == 0) {
+            path_cache_clear();
+            continue;
+        }
+        if (strchr(name, '/')) continue;
+        if (path_cache_rehash(name) != 0) {
+            fprintf(stderr, "hash: %s: not found\n", name);
+            rc = 1;
+        }
+    }
+    return rc;
+}
+
+// Length of the NAME in a NAME=value word, 0 if word is not one
+static size_t assignment_name(const char *word) {
+    size_t n = var_name_length(word);
+    return n && word[n] == '=' ? n : 0;
+}
+
+// Sets NAME=value, or the named variable's current value with no '='
+static int set_from_word(const char *builtin, const char *word, int export) {
+    size_t n = var_name_length(word);
+    char name[256];
+
+    if (n == 0 || n >= sizeof(name) || (word[n] != '=' && word[n] != '\0')) {
+        fprintf(stderr, "%s: `%s': not a valid identifier\n", builtin, word);
+        return 1;
+    }
+    memcpy(name, word, n);
+    name[n] = '\0';
+    return var_set(name, word[n] ? word + n + 1 : NULL, export) == 0 ? 0 : 1;
+}
+
+// Builtin: export [name[=value]...]; lists the exports with no argument
+static int builtin_export(const command_t *cmd) {
+    int rc = 0;
+
+    if (cmd->num_args == 1) return var_print_exports() == 0 ? 0 : 1;
+    for (int i = 1; i < cmd->num_args; i++) {
+        if (set_from_word("export", cmd->args[i], 1) != 0) rc = 1;
+    }
+    return rc;
+}
+
+// Builtin: unset name...
+static int builtin_unset(const command_t *cmd) {
+    int rc = 0;
+
+    for (int i = 1; i < cmd->num_args; i++) {
+        const char *name = cmd->args[i];
+        if (var_name_length(name) != strlen(name)) {
+            fprintf(stderr, "unset: `%s': not a valid identifier\n", name);
+            rc = 1;
+            continue;
+        }
+        var_unset(name);
+    }
+    return rc;
+}
+
+// NAME=value [NAME=value...] on its own sets shell variables
+static int run_assignments(const command_t *cmd) {
+    for (int i = 0; i < cmd->num_args; i++) {
+        if (!assignment_name(cmd->args[i])) {
+            fprintf(stderr, "Error: Assignments before a command are not supported.\n");
+            return 127;
+        }
+    }
+    for (int i = 0; i < cmd->num_args; i++) {
+        if (set_from_word("assignment", cmd->args[i], 0) != 0) return 1;
+    }
+    return 0;
+}
+
+static const builtin_t builtins[] = {
+    { "exit", builtin_exit },
+    { "cd",   builtin_cd },
+    { "set",  builtin_set },
+    { "hash", builtin_hash },
+    { "jobs", builtin_jobs },
+    { "wait", builtin_wait },
+    { "fg",   builtin_fg },
+    { "bg",   builtin_bg },
+    { "export", builtin_export },
+    { "unset", builtin_unset },
+};
+
+// Points the shell's fds 0, 1 and 2 at cmd's redirections while a builtin
+// runs. saved gets the originals: -1 for an fd left alone, -2 for one
+// that was closed. Returns -1 after reporting a failure, changing nothing.
+static int redirect_builtin(const command_t *cmd, int saved[3]) {
+    const int base[3] = { -1, -1, -1 };
+    int fds[3];
+    int opened[3];
+
+    for (int k = 0; k < 3; k++) saved[k] = -1;
+    if (open_redirections(cmd, base, fds, opened) != 0) return -1;
+    fflush(stdout);
+    fflush(stderr);
+    for (int k = 0; k < 3; k++) {
+        if (fds[k] == -1) continue;
+        saved[k] = fcntl(k, F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+        if (saved[k] == -1) saved[k] = -2;
+        dup2(fds[k], k);
+    }
+    close_redirections(opened);
+    return 0;
+}
+
+static void restore_builtin(int saved[3]) {
+    fflush(stdout);
+    fflush(stderr);
+    for (int k = 0; k < 3; k++) {
+        if (saved[k] == -2) {
+            close(k);
+        } else if (saved[k] != -1) {
+            dup2(saved[k], k);
+            close(saved[k]);
+        }
+    }
+}
+
+// Whether a command named word runs in the shell: a builtin or an
+// assignment
+int is_builtin(const char *word) {
+    if (assignment_name(word)) return 1;
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (strcmp(word, builtins[i].name) == 0) return 1;
+    }
+    return 0;
+}
+
+// Runs builtins in the shell itself, with the command's redirections in
+// place around them; returns 0 if cmd is not a builtin, otherwise 1 with
+// the builtin's exit status in *status
+int run_builtin(const command_t *cmd, int *status) {
+    int (*fn)(const command_t *cmd) = NULL;
+    int saved[3];
+
+    if (assignment_name(cmd->args[0])) fn = run_assignments;
+    for (size_t i = 0; !fn && i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (strcmp(cmd->args[0], builtins[i].name) == 0) fn = builtins[i].fn;
+    }
+    if (!fn) return 0;
+
+    if (cmd->num_redirs == 0) {
+        *status = fn(cmd);
+        return 1;
+    }
+    if (redirect_builtin(cmd, saved) != 0) {
+        *status = 1;
+        return 1;
+    }
+    *status = fn(cmd);
+    restore_builtin(saved);
+    return 1;
+}
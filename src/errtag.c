@@ -0,0 +1,164 @@
+// stderrtag: every stage of a foreground job writes its stderr into a
+// pipe of its own, which the shell drains with epoll while it waits for
+// the job. Each line is passed on to the shell's stderr behind the
+// stage it came from, e.g. "[2 grep] grep: foo: No such file".
+
+#include "shell.h"
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+
+int stderr_tag;
+
+// One tagged stage
+typedef struct {
+    int fd;             // Read end, -1 when untagged or once at EOF
+    char *prefix;
+    char *line;         // Start of a line still waiting for its newline
+    size_t len;
+} errtag_stage_t;
+
+struct errtag {
+    int epfd;
+    int open;                   // Read ends not at EOF yet
+    int num_stages;
+    errtag_stage_t *stages;
+    size_t out_len;
+    char out[READ_CHUNK_SIZE];  // Lines from one wakeup, sent in one write
+};
+
+// Sets up tagging for the stages of pl. Stages get their pipes from
+// errtag_pipe as they are launched. Returns NULL after reporting a
+// failure, in which case the job runs untagged.
+errtag_t *errtag_open(arena_t *a, const pipeline_t *pl) {
+    errtag_t *t = (errtag_t *)arena_alloc(a, sizeof(*t));
+    size_t size = (size_t)pl->num_cmds * sizeof(errtag_stage_t);
+
+    if (t) t->stages = (errtag_stage_t *)arena_alloc(a, size);
+    if (!t || !t->stages) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return NULL;
+    }
+    t->open = 0;
+    t->num_stages = pl->num_cmds;
+    t->out_len = 0;
+    for (int i = 0; i < pl->num_cmds; i++) {
+        const char *name = pl->cmds[i].args[0];
+        errtag_stage_t *st = &t->stages[i];
+
+        st->fd = -1;
+        st->len = 0;
+        st->prefix = (char *)arena_alloc(a, strlen(name) + 32);
+        st->line = (char *)arena_alloc(a, ERRTAG_LINE_MAX);
+        if (!st->prefix || !st->line) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            return NULL;
+        }
+        sprintf(st->prefix, "[%d %s] ", i + 1, name);
+    }
+    t->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (t->epfd == -1) {
+        fprintf(stderr, "Error: epoll_create1() failed. %s.\n", strerror(errno));
+        return NULL;
+    }
+    return t;
+}
+
+// Creates stage i's pipe and returns the end the stage writes to, which
+// the caller closes once the stage is started. -1 leaves the stage with
+// the shell's stderr.
+int errtag_pipe(errtag_t *t, int i) {
+    struct epoll_event ev;
+    int fds[2];
+
+    if (pipe2(fds, O_CLOEXEC) == -1) return -1;
+    // Only our end: the stage gets a normal blocking stderr
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    ev.events = EPOLLIN;
+    ev.data.u32 = (uint32_t)i;
+    if (epoll_ctl(t->epfd, EPOLL_CTL_ADD, fds[0], &ev) == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    t->stages[i].fd = fds[0];
+    t->open++;
+    return fds[1];
+}
+
+static void errtag_flush(errtag_t *t) {
+    // Best effort, like any write to stderr
+    if (t->out_len > 0) write_all(STDERR_FILENO, t->out, t->out_len);
+    t->out_len = 0;
+}
+
+static void errtag_put(errtag_t *t, const char *s, size_t n) {
+    if (t->out_len + n > sizeof(t->out)) errtag_flush(t);
+    if (n > sizeof(t->out)) {
+        write_all(STDERR_FILENO, s, n);
+        return;
+    }
+    memcpy(t->out + t->out_len, s, n);
+    t->out_len += n;
+}
+
+// Queues stage st's pending line, which ends in a newline unless it is
+// cut short by its length or by EOF
+static void errtag_line(errtag_t *t, errtag_stage_t *st) {
+    errtag_put(t, st->prefix, strlen(st->prefix));
+    errtag_put(t, st->line, st->len);
+    if (st->line[st->len - 1] != '\n') errtag_put(t, "\n", 1);
+    st->len = 0;
+}
+
+// Sends stage st's partial line, if any, and closes its pipe
+static void errtag_end(errtag_t *t, errtag_stage_t *st) {
+    if (st->len > 0) errtag_line(t, st);
+    close(st->fd);
+    st->fd = -1;
+    t->open--;
+}
+
+// Reads what stage i has written so far, up to EOF
+static void errtag_read(errtag_t *t, int i) {
+    errtag_stage_t *st = &t->stages[i];
+    char buf[READ_CHUNK_SIZE];
+
+    for (;;) {
+        ssize_t n = read(st->fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) return;
+        if (n <= 0) break;
+        for (ssize_t k = 0; k < n; k++) {
+            st->line[st->len++] = buf[k];
+            if (buf[k] == '\n' || st->len == ERRTAG_LINE_MAX) errtag_line(t, st);
+        }
+    }
+    errtag_end(t, st);
+}
+
+// Waits up to timeout ms (-1 for ever) for stages to write, with the
+// signal mask set to mask if it is not NULL, and passes on what they
+// wrote. Returns -1 right away if no pipe is left to wait on.
+int errtag_drain(errtag_t *t, int timeout, const sigset_t *mask) {
+    struct epoll_event evs[16];
+    int n;
+
+    if (t->open == 0) return -1;
+    n = epoll_pwait(t->epfd, evs, 16, timeout, mask);
+    for (int k = 0; k < n; k++) errtag_read(t, (int)evs[k].data.u32);
+    errtag_flush(t);
+    return 0;
+}
+
+// Passes on whatever is still buffered in the pipes and closes them; a
+// stage that left a background process holding its stderr is not waited
+// for.
+void errtag_close(errtag_t *t) {
+    for (int i = 0; i < t->num_stages; i++) {
+        if (t->stages[i].fd != -1) errtag_read(t, i);
+        if (t->stages[i].fd != -1) errtag_end(t, &t->stages[i]);
+    }
+    errtag_flush(t);
+    close(t->epfd);
+}
@@ -0,0 +1,446 @@
+// Word expansion: $ references, $(...) substitutions and wildcards the
+// lexer marked, filled in when their pipeline runs so that `false; echo
+// $?` sees the right status, `X=1; echo $X` the new value and `rm *.tmp;
+// ls *` the files as they are by then
+
+#include "shell.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+static const char pipestatus_name[] = "PIPESTATUS";
+
+static int is_pipestatus(const char *name, size_t len) {
+    return len == sizeof(pipestatus_name) - 1 && strncmp(name, pipestatus_name, len) == 0;
+}
+
+// Length of the parameter reference at s, which starts with '$': $?,
+// $NAME, ${NAME}, ${PIPESTATUS[n]} or ${PIPESTATUS[@]}. Anything else
+// gives 0 and stays literal.
+size_t param_length(const char *s) {
+    size_t nlen = sizeof(pipestatus_name) - 1;
+    size_t n;
+
+    if (s[1] == '?') return 2;
+    if ((n = var_name_length(s + 1)) != 0) return 1 + n;
+    if (s[1] != '{') return 0;
+    if (strncmp(s + 2, pipestatus_name, nlen) == 0 && s[2 + nlen] == '[') {
+        const char *p = s + 3 + nlen;
+        if ((p[0] == '@' || p[0] == '*') && p[1] == ']' && p[2] == '}') {
+            return (size_t)(p + 3 - s);
+        }
+        while (isdigit((unsigned char)*p)) p++;
+        if (p == s + 3 + nlen || p[0] != ']' || p[1] != '}') return 0;
+        return (size_t)(p + 2 - s);
+    }
+    n = var_name_length(s + 2);
+    return n && s[2 + n] == '}' ? n + 3 : 0;
+}
+
+// Name of the variable a $NAME or ${NAME} reference at s refers to, with
+// its length in *len; NULL for the status parameters
+static const char *param_name(const char *s, size_t *len) {
+    const char *name = s[1] == '{' ? s + 2 : s + 1;
+
+    *len = var_name_length(name);
+    if (*len == 0 || (s[1] == '{' && name[*len] != '}')) return NULL;
+    return name;
+}
+
+// Longest text the reference at s can expand to
+static size_t param_max(const char *s) {
+    size_t len;
+    const char *name = param_name(s, &len);
+
+    if (name && !is_pipestatus(name, len)) {
+        const char *value = var_lookup(name, len);
+        return value ? strlen(value) : 0;
+    }
+    return (size_t)(pipe_status_count + 1) * 4;
+}
+
+// Writes the value of the reference at s (the PARAM_MARK, then the
+// text param_length accepted) to out. Returns the input bytes used.
+static size_t expand_param(const char *s, char *out, size_t *outlen) {
+    size_t nlen = sizeof(pipestatus_name) - 1;
+    const char *name, *p;
+    size_t len;
+    int idx;
+
+    *outlen = 0;
+    if (s[1] == '?') {
+        *outlen = (size_t)sprintf(out, "%d", last_status);
+        return 2;
+    }
+    if ((name = param_name(s, &len)) != NULL) {
+        const char *value;
+        if (is_pipestatus(name, len)) {
+            // Bare $PIPESTATUS is its first element, as in bash
+            if (pipe_status_count > 0) *outlen = (size_t)sprintf(out, "%d", pipe_status[0]);
+        } else if ((value = var_lookup(name, len)) != NULL) {
+            *outlen = strlen(value);
+            memcpy(out, value, *outlen);
+        }
+        return (size_t)(name + len - s) + (s[1] == '{');
+    }
+    p = s + 3 + nlen;
+    if (p[0] == '@' || p[0] == '*') {
+        for (int i = 0; i < pipe_status_count; i++) {
+            *outlen += (size_t)sprintf(out + *outlen, i ? " %d" : "%d", pipe_status[i]);
+        }
+        return (size_t)(p + 3 - s);
+    }
+    idx = atoi(p);
+    while (isdigit((unsigned char)*p)) p++;
+    if (idx >= 0 && idx < pipe_status_count) {
+        *outlen = (size_t)sprintf(out, "%d", pipe_status[idx]);
+    }
+    return (size_t)(p + 2 - s);
+}
+
+// Length of the $(...) at s, which starts at its '(', through the
+// matching ')'; 0 if it is never closed. Quoted parentheses don't count.
+size_t subst_length(const char *s) {
+    int depth = 0;
+    char quote = 0;
+
+    for (const char *p = s; *p; p++) {
+        if (quote) {
+            if (*p == quote) quote = 0;
+        } else if (*p == '\'' || *p == '"' || *p == '`') {
+            quote = *p;
+        } else if (*p == '(') {
+            depth++;
+        } else if (*p == ')' && --depth == 0) {
+            return (size_t)(p + 1 - s);
+        }
+    }
+    return 0;
+}
+
+// The (command) of a substitution marked at s, or NULL when s is a
+// parameter reference. *quoted is set if it was inside double quotes;
+// a quoted reference then starts at s + 1, its '"' standing in for '$'.
+static const char *subst_body(const char *s, int *quoted) {
+    const char *p = s + 1;
+
+    *quoted = *p == '"';
+    if (*quoted) p++;
+    return *p == '(' ? p : NULL;
+}
+
+// Runs the (command) at body in a forked copy of the shell, so that a cd
+// or exit inside stays there, and reads its stdout to EOF in big chunks
+// straight into a buffer the arena then adopts: the output is never
+// copied. Trailing newlines are dropped. Returns NULL on error.
+static char *run_subst(arena_t *a, const char *body, size_t len, size_t *outlen) {
+    char *line = (char *)arena_alloc(a, len - 1);
+    char *buf = NULL;
+    size_t cap = 0, used = 0;
+    int fds[2], status;
+    pid_t pid;
+
+    if (!line) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return NULL;
+    }
+    memcpy(line, body + 1, len - 2);
+    line[len - 2] = '\0';
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        fprintf(stderr, "Error: Cannot create pipe. %s.\n", strerror(errno));
+        return NULL;
+    }
+
+    // Nothing buffered may be written twice
+    fflush(NULL);
+    pid = fork();
+    if (pid == -1) {
+        fprintf(stderr, "Error: fork() failed. %s.\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+    if (pid == 0) {
+        ms_plan_t *plan;
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+        // The parent's jobs and terminal are not this copy's to manage
+        job_control = 0;
+        job_table = NULL;
+        plan = ms_parse(line);
+        if (plan) ms_run(plan);
+        fflush(stdout);
+        _exit(plan ? last_status : 2);
+    }
+
+    close(fds[1]);
+    for (;;) {
+        char *grown = arena_buffer_grow(buf, &cap, used + READ_CHUNK_SIZE);
+        ssize_t n;
+
+        if (!grown) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            break;
+        }
+        buf = grown;
+        // One byte is kept for the terminating NUL
+        n = read(fds[0], buf + used, cap - used - 1);
+        if (n > 0) used += (size_t)n;
+        else if (n == 0 || errno != EINTR) break;
+    }
+    close(fds[0]);
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {}
+    if (!buf) return NULL;
+
+    while (used > 0 && buf[used - 1] == '\n') used--;
+    buf[used] = '\0';
+    arena_adopt(a, buf, cap);
+    *outlen = used;
+    return buf;
+}
+
+// Turns the blanks in the len bytes of unquoted expansion output at s
+// into FIELD_MARKs
+static void mark_fields(char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == ' ' || s[i] == '\t' || s[i] == '\n') s[i] = FIELD_MARK;
+    }
+}
+
+// Returns word with its references and substitutions expanded. With
+// split set, blanks in the output of unquoted expansions become
+// FIELD_MARKs, and a word with no quotes (quoted clear) and no literal
+// text whose expansions come out empty becomes a lone FIELD_MARK, so it
+// is no argument at all; ""$E stays an empty one. A word that is a
+// single substitution is its output buffer; anything else is built in a
+// new arena string.
+static char *expand_word(arena_t *a, const char *word, int split, int quoted_word) {
+    size_t size = strlen(word) + 1;
+    char **outs = NULL;
+    size_t *lens = NULL;
+    const char *m;
+    char *out, *o;
+    int nsubst = 0, k = 0, quoted;
+    int kept = quoted_word;     // Some quotes or literal text
+
+    for (m = word; (m = strchr(m, PARAM_MARK)) != NULL; m++) {
+        if (subst_body(m, &quoted)) nsubst++;
+    }
+    if (nsubst) {
+        outs = (char **)arena_alloc(a, (size_t)nsubst * sizeof(char *));
+        lens = (size_t *)arena_alloc(a, (size_t)nsubst * sizeof(size_t));
+        if (!outs || !lens) goto oom;
+    }
+
+    // Substitutions run first, in order, so their sizes are known
+    for (m = word; (m = strchr(m, PARAM_MARK)) != NULL; m++) {
+        const char *body = subst_body(m, &quoted);
+        size_t n;
+
+        if (!body) {
+            size += param_max(m + quoted);
+            continue;
+        }
+        n = subst_length(body);
+        if (!(outs[k] = run_subst(a, body, n, &lens[k]))) return NULL;
+        if (split && !quoted) mark_fields(outs[k], lens[k]);
+        size += lens[k++];
+        if (m == word && body[n] == '\0' && nsubst == 1) {
+            // Nothing around it: an empty unquoted result is no word at all
+            if (split && !kept && lens[0] == 0) {
+                outs[0][0] = FIELD_MARK;
+                outs[0][1] = '\0';
+            }
+            return outs[0];
+        }
+        m = body + n - 1;
+    }
+
+    out = (char *)arena_alloc(a, size);
+    if (!out) goto oom;
+    k = 0;
+    for (o = out; *word; ) {
+        const char *body;
+        size_t n;
+
+        if (*word != PARAM_MARK) {
+            *o++ = *word++;
+            kept = 1;
+            continue;
+        }
+        if ((body = subst_body(word, &quoted)) != NULL) {
+            n = lens[k];
+            memcpy(o, outs[k++], n);
+            word = body + subst_length(body);
+        } else {
+            word += quoted + expand_param(word + quoted, o, &n);
+            if (split && !quoted) mark_fields(o, n);
+        }
+        o += n;
+    }
+    if (split && !kept && o == out) *o++ = FIELD_MARK;
+    *o = '\0';
+    return out;
+
+oom:
+    fprintf(stderr, "Error: Out of memory.\n");
+    return NULL;
+}
+
+// Drops the GLOB_MARKs of a pattern that matched nothing, leaving the
+// word as it was written
+static void strip_glob_marks(char *word) {
+    char *o = word;
+
+    for (const char *p = word; *p; p++) {
+        if (*p != GLOB_MARK) *o++ = *p;
+    }
+    *o = '\0';
+}
+
+// argv under construction, in a malloc'd array
+typedef struct {
+    char **words;
+    int count;
+    int cap;
+} word_list_t;
+
+static int push_words(word_list_t *l, char **words, int n) {
+    if (l->count + n >= l->cap) {
+        int cap = l->cap ? l->cap : 16;
+        char **grown;
+        while (l->count + n >= cap) cap *= 2;
+        if (!(grown = (char **)realloc(l->words, (size_t)cap * sizeof(char *)))) return -1;
+        l->words = grown;
+        l->cap = cap;
+    }
+    memcpy(l->words + l->count, words, (size_t)n * sizeof(char *));
+    l->count += n;
+    return 0;
+}
+
+// Adds word, or the paths it matches if it has wildcards
+static int add_word(word_list_t *l, arena_t *a, char *word) {
+    char **matches;
+    int n, rc;
+
+    if (!strchr(word, GLOB_MARK)) return push_words(l, &word, 1);
+    n = glob_word(a, word, &matches);
+    if (n < 0) return -1;
+    if (n == 0) {
+        strip_glob_marks(word);
+        rc = push_words(l, &word, 1);
+    } else {
+        rc = push_words(l, matches, n);
+    }
+    free(matches);
+    return rc;
+}
+
+// Rebuilds the argv of cmd: words are cut at their FIELD_MARKs in place,
+// dropping empty fields, and each piece with wildcards is replaced by
+// the paths it matches
+static int reshape_args(arena_t *a, command_t *cmd) {
+    word_list_t l = { NULL, 0, 0 };
+
+    for (int j = 0; j < cmd->num_args; j++) {
+        char *field = cmd->args[j];
+        int split = strchr(field, FIELD_MARK) != NULL;
+        for (;;) {
+            char *end = strchr(field, FIELD_MARK);
+            if (end) *end = '\0';
+            if ((*field || !split) && add_word(&l, a, field) != 0) goto oom;
+            if (!end) break;
+            field = end + 1;
+        }
+    }
+
+    cmd->args = (char **)arena_alloc(a, ((size_t)l.count + 1) * sizeof(char *));
+    if (!cmd->args) goto oom;
+    if (l.count) memcpy(cmd->args, l.words, (size_t)l.count * sizeof(char *));
+    cmd->args[l.count] = NULL;
+    cmd->num_args = l.count;
+    free(l.words);
+    return 0;
+
+oom:
+    free(l.words);
+    return -1;
+}
+
+// Expands a wildcard in a redirect, which must name a single file
+static int glob_file(arena_t *a, char **file) {
+    char **matches;
+    int n = glob_word(a, *file, &matches);
+
+    if (n < 0) return -1;
+    if (n == 0) strip_glob_marks(*file);
+    else if (n == 1) *file = matches[0];
+    free(matches);
+    if (n > 1) {
+        strip_glob_marks(*file);
+        fprintf(stderr, "Error: Ambiguous redirect '%s'.\n", *file);
+        return 1;
+    }
+    return 0;
+}
+
+static int is_assignment(const char *word) {
+    size_t n = var_name_length(word);
+    return n && word[n] == '=';
+}
+
+// Expands the marked words of every stage in pl, in place: parameters
+// and substitutions first, then field splitting and wildcards. Returns
+// -1 on error.
+int expand_pipeline(arena_t *a, pipeline_t *pl) {
+    for (int i = 0; i < pl->num_cmds; i++) {
+        command_t *cmd = &pl->cmds[i];
+        int reshape = 0;
+        int assigns, exports;
+
+        if (!cmd->expand) continue;
+        // As in sh, assignments are not split: X=$(cmd) keeps the blanks
+        assigns = is_assignment(cmd->args[0]);
+        exports = strcmp(cmd->args[0], "export") == 0;
+        for (int j = 0; j < cmd->num_args; j++) {
+            int split = !((assigns || (exports && j > 0)) && is_assignment(cmd->args[j]));
+            if (strchr(cmd->args[j], PARAM_MARK) &&
+                !(cmd->args[j] = expand_word(a, cmd->args[j], split, cmd->quoted[j]))) {
+                return -1;
+            }
+            if (strpbrk(cmd->args[j], "\002\003")) reshape = 1;
+        }
+        if (reshape && reshape_args(a, cmd) != 0) goto oom;
+        if (cmd->num_args == 0) {
+            fprintf(stderr, "Error: Command expanded to nothing.\n");
+            return -1;
+        }
+        for (int j = 0; j < cmd->num_redirs; j++) {
+            redir_t *r = &cmd->redirs[j];
+            int rc;
+            if (r->here && strchr(r->here, PARAM_MARK) &&
+                !(r->here = expand_word(a, r->here, 0, 1))) {
+                return -1;
+            }
+            if (!r->file) continue;
+            if (strchr(r->file, PARAM_MARK) && !(r->file = expand_word(a, r->file, 0, 1))) {
+                return -1;
+            }
+            if (!strchr(r->file, GLOB_MARK)) continue;
+            if ((rc = glob_file(a, &r->file)) < 0) goto oom;
+            if (rc > 0) return -1;
+        }
+        cmd->expand = 0;
+        cmd->quoted = NULL;
+    }
+    return 0;
+
+oom:
+    fprintf(stderr, "Error: Out of memory.\n");
+    return -1;
+}
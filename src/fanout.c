@@ -0,0 +1,231 @@
+// Fan-out for >(...): a helper process hands a copy of a stage's output
+// to each consumer and the output itself on to where it was going, using
+// tee(2) and splice(2) so the bytes stay in the kernel
+
+#include "shell.h"
+
+#include <fcntl.h>
+#include <sys/wait.h>
+
+// One place the stream goes
+typedef struct {
+    int fd;
+    int live;           // Cleared once its reader has gone away
+    int copy;           // splice refused it, so read and write do the job
+} fanout_out_t;
+
+// Stops writing to an output. Losing the reader is normal; anything
+// else gets reported.
+static void fanout_drop(fanout_out_t *out) {
+    if (errno != EPIPE) fprintf(stderr, "Error: Fan-out write failed. %s.\n", strerror(errno));
+    out->live = 0;
+}
+
+// Moves exactly len bytes from the pipe in_fd to out. An fd splice
+// cannot write, such as an O_APPEND file, gets them through a buffer;
+// a dropped output has them read and thrown away. Returns -1 if in_fd
+// cannot be read.
+static int fanout_move(int in_fd, fanout_out_t *out, size_t len) {
+    char buf[READ_CHUNK_SIZE];
+
+    while (len > 0) {
+        ssize_t n;
+
+        if (out->live && !out->copy) {
+            n = splice(in_fd, NULL, out->fd, NULL, len, SPLICE_F_MOVE);
+            if (n > 0) len -= (size_t)n;
+            else if (n < 0 && errno == EINVAL) out->copy = 1;
+            else if (n < 0 && errno != EINTR) fanout_drop(out);
+            continue;
+        }
+        n = read(in_fd, buf, len < sizeof(buf) ? len : sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        len -= (size_t)n;
+        if (out->live && write_all(out->fd, buf, (size_t)n) != 0) fanout_drop(out);
+    }
+    return 0;
+}
+
+// Copies the len bytes in the pipe in_fd to out with tee, moving each
+// piece on to the pipe next_fd once out has it. tee always starts at
+// the front of a pipe, so a short one has to be moved along before the
+// rest can follow.
+static int fanout_tee(int in_fd, fanout_out_t *out, int next_fd, size_t len) {
+    fanout_out_t next = { next_fd, 1, 0 };
+
+    while (len > 0) {
+        ssize_t n = (ssize_t)len;
+
+        if (out->live) {
+            n = tee(in_fd, out->fd, len, 0);
+            if (n < 0) {
+                if (errno != EINTR) fanout_drop(out);
+                continue;
+            }
+            if (n == 0) return -1;
+        }
+        if (fanout_move(in_fd, &next, (size_t)n) != 0 || !next.live) return -1;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Pumps src to every live output until EOF. Each round splices what src
+// holds into one of two link pipes, then walks it along the outputs,
+// teeing it into each and moving it to the other link, until the last
+// output is handed the pages themselves. The links are as big as src
+// and drained every round, so the moves between them never block.
+// Returns early once no output is left, so the stage gets SIGPIPE.
+static int fanout_pump(int src, fanout_out_t *outs, int n, int links[2][2]) {
+    for (;;) {
+        int last = -1;
+        int cur = 0;
+        ssize_t len;
+
+        for (int o = 0; o < n; o++) {
+            if (outs[o].live) last = o;
+        }
+        if (last < 0) return 0;
+
+        len = splice(src, NULL, links[0][1], NULL, 1 << 30, SPLICE_F_MOVE);
+        if (len < 0 && errno == EINTR) continue;
+        if (len <= 0) return len == 0 ? 0 : -1;
+        for (int o = 0; o < last; o++) {
+            if (!outs[o].live) continue;
+            if (fanout_tee(links[cur][0], &outs[o], links[!cur][1], (size_t)len) != 0) return -1;
+            cur = !cur;
+        }
+        if (fanout_move(links[cur][0], &outs[last], (size_t)len) != 0) return -1;
+    }
+}
+
+// Two empty pipes for fanout_pump, each the size of src. One that cannot
+// grow pulls the other down to its own size.
+static int fanout_links(int src, int links[2][2]) {
+    int size = fcntl(src, F_GETPIPE_SZ);
+    int got[2];
+
+    for (int k = 0; k < 2; k++) {
+        if (pipe2(links[k], O_CLOEXEC) == -1) return -1;
+        if (size > 0) fcntl(links[k][1], F_SETPIPE_SZ, size);
+        got[k] = fcntl(links[k][1], F_GETPIPE_SZ);
+    }
+    if (got[0] > got[1]) fcntl(links[0][1], F_SETPIPE_SZ, got[1]);
+    if (got[1] > got[0]) fcntl(links[1][1], F_SETPIPE_SZ, got[0]);
+    return 0;
+}
+
+// Runs one >(...) command line in a copy of the shell reading in_fd,
+// as a command substitution runs its command
+static void run_consumer(const char *line, int in_fd) {
+    ms_plan_t *plan;
+
+    dup2(in_fd, STDIN_FILENO);
+    close(in_fd);
+    signal(SIGPIPE, SIG_DFL);
+    job_control = 0;
+    job_table = NULL;
+    plan = ms_parse(line);
+    if (plan) ms_run(plan);
+    fflush(stdout);
+    _exit(plan ? last_status : 2);
+}
+
+// Helper side: starts the consumers on pipes of their own, pumps src to
+// them and to out_fd, then waits for them all. The consumers write to
+// the job's stdout and stderr.
+static void run_fanout(const command_t *cmd, int src, int out_fd, const int *std_fds,
+                       const stage_io_t *io) {
+    int n = cmd->num_fanout + 1;
+    fanout_out_t *outs = (fanout_out_t *)calloc((size_t)n, sizeof(fanout_out_t));
+    int links[2][2];
+    int rc;
+
+    signal(SIGINT, SIG_DFL);
+    if (io->pgid >= 0) {
+        setpgid(0, io->pgid);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+    }
+    // The stage's ends of its pipes; holding them would keep EOF away
+    if (io->in_fd > STDERR_FILENO) close(io->in_fd);
+    close(io->out_fd);
+    if (io->close_fd != -1) close(io->close_fd);
+    if (std_fds && std_fds[1] != -1) dup2(std_fds[1], STDOUT_FILENO);
+    if (io->err_fd != -1) dup2(io->err_fd, STDERR_FILENO);
+    if (!outs) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        _exit(1);
+    }
+
+    for (int j = 0; j < cmd->num_fanout; j++) {
+        int fds[2];
+        pid_t pid;
+
+        if (pipe2(fds, O_CLOEXEC) == -1) {
+            fprintf(stderr, "Error: pipe() failed. %s.\n", strerror(errno));
+            continue;
+        }
+        pid = fork();
+        if (pid == 0) {
+            for (int k = 0; k < j; k++) {
+                if (outs[k].live) close(outs[k].fd);
+            }
+            close(src);
+            if (out_fd > STDERR_FILENO) close(out_fd);
+            close(fds[1]);
+            run_consumer(cmd->fanout[j], fds[0]);
+        }
+        close(fds[0]);
+        if (pid < 0) {
+            fprintf(stderr, "Error: fork() failed. %s.\n", strerror(errno));
+            close(fds[1]);
+            continue;
+        }
+        outs[j].fd = fds[1];
+        outs[j].live = 1;
+    }
+    outs[n - 1].fd = out_fd != -1 ? out_fd : STDOUT_FILENO;
+    outs[n - 1].live = 1;
+
+    // Readers that go away show up as EPIPE on their output alone
+    signal(SIGPIPE, SIG_IGN);
+    if (fanout_links(src, links) != 0) {
+        fprintf(stderr, "Error: pipe() failed. %s.\n", strerror(errno));
+        rc = 1;
+    } else if ((rc = fanout_pump(src, outs, n, links)) != 0) {
+        fprintf(stderr, "Error: Fan-out failed. %s.\n", strerror(errno));
+        rc = 1;
+    }
+
+    close(src);
+    for (int j = 0; j < n - 1; j++) {
+        if (outs[j].live) close(outs[j].fd);
+    }
+    while (wait(NULL) != -1 || errno == EINTR) {}
+    _exit(rc);
+}
+
+// Starts the helper for a stage with >(...) consumers. The stage writes
+// into the pipe whose read end is src_fd and io->out_fd its write end;
+// what it writes also goes on to out_fd, -1 for the job's stdout.
+// Returns the helper's pid, or -1.
+pid_t launch_fanout(const command_t *cmd, int src_fd, int out_fd, const int *std_fds,
+                    const stage_io_t *io) {
+    pid_t pid;
+
+    if (out_fd == -1 && std_fds) out_fd = std_fds[1];
+    // Nothing buffered may be written twice
+    fflush(NULL);
+    pid = fork();
+    if (pid == 0) run_fanout(cmd, src_fd, out_fd, std_fds, io);
+    if (pid < 0) {
+        fprintf(stderr, "Error: fork() failed. %s.\n", strerror(errno));
+        return -1;
+    }
+    // Set the group from both sides so neither races the other
+    if (io->pgid >= 0) setpgid(pid, io->pgid ? io->pgid : pid);
+    return pid;
+}
@@ -0,0 +1,387 @@
+// In-process versions of echo, cat, true, false and printf
+
+#include "shell.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+// Command the shell can run as a pipeline stage without exec
+typedef struct {
+    const char *name;
+    stage_fn_t fn;
+} fast_stage_t;
+
+int fastpath = 1;
+
+// Writes all of buf, retrying short writes
+int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Growable output buffer for the fast-path echo and printf
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} outbuf_t;
+
+static int outbuf_put(outbuf_t *b, const char *s, size_t n) {
+    if (b->cap - b->len < n) {
+        size_t cap = b->cap ? b->cap : 256;
+        char *grown;
+        while (cap - b->len < n) cap *= 2;
+        grown = (char *)realloc(b->data, cap);
+        if (!grown) return -1;
+        b->data = grown;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+    return 0;
+}
+
+// Sends the buffer in one write and frees it
+static int outbuf_flush(outbuf_t *b, int out_fd, const char *name) {
+    int rc = 0;
+    if (b->len > 0 && write_all(out_fd, b->data, b->len) != 0) {
+        fprintf(stderr, "%s: write error: %s\n", name, strerror(errno));
+        rc = 1;
+    }
+    free(b->data);
+    return rc;
+}
+
+// Moves everything from in_fd to out_fd, keeping the bytes in the kernel
+// where the fd types allow it: copy_file_range between regular files,
+// splice when either side is a pipe, sendfile from a regular file.
+// Each method falls through to the next if it fails before moving data.
+int copy_fd(int in_fd, int out_fd) {
+    struct stat in_st, out_st;
+    ssize_t n;
+    int moved;
+    char buf[READ_CHUNK_SIZE];
+
+    if (fstat(in_fd, &in_st) != 0 || fstat(out_fd, &out_st) != 0) return -1;
+
+    if (S_ISREG(in_st.st_mode) && S_ISREG(out_st.st_mode)) {
+        moved = 0;
+        while ((n = copy_file_range(in_fd, NULL, out_fd, NULL, 1 << 30, 0)) > 0) moved = 1;
+        if (n == 0) return 0;
+        if (moved) return -1;
+    }
+    if (S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode)) {
+        moved = 0;
+        while ((n = splice(in_fd, NULL, out_fd, NULL, 1 << 30, SPLICE_F_MOVE)) > 0) moved = 1;
+        if (n == 0) return 0;
+        if (moved && errno != EINTR) return -1;
+    }
+    if (S_ISREG(in_st.st_mode)) {
+        moved = 0;
+        while ((n = sendfile(out_fd, in_fd, NULL, 1 << 30)) > 0) moved = 1;
+        if (n == 0) return 0;
+        if (moved) return -1;
+    }
+
+    while ((n = read(in_fd, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (write_all(out_fd, buf, (size_t)n) != 0) return -1;
+    }
+    return 0;
+}
+
+static int fast_true(char **argv, int in_fd, int out_fd) {
+    (void)argv; (void)in_fd; (void)out_fd;
+    return 0;
+}
+
+static int fast_false(char **argv, int in_fd, int out_fd) {
+    (void)argv; (void)in_fd; (void)out_fd;
+    return 1;
+}
+
+// echo [-n]... args...; any other option, such as -e or -ne, goes to the
+// real echo
+static int fast_echo(char **argv, int in_fd, int out_fd) {
+    outbuf_t out = { NULL, 0, 0 };
+    int newline = 1;
+    int i = 1;
+
+    (void)in_fd;
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1] &&
+           strspn(argv[i] + 1, "neE") == strlen(argv[i] + 1); i++) {
+        if (strcmp(argv[i], "-n") != 0) return FAST_DECLINE;
+        newline = 0;
+    }
+    for (; argv[i]; i++) {
+        if ((out.len && outbuf_put(&out, " ", 1) != 0) ||
+            outbuf_put(&out, argv[i], strlen(argv[i])) != 0) {
+            free(out.data);
+            return FAST_DECLINE;
+        }
+    }
+    if (newline && outbuf_put(&out, "\n", 1) != 0) {
+        free(out.data);
+        return FAST_DECLINE;
+    }
+    return outbuf_flush(&out, out_fd, "echo");
+}
+
+// cat [file | -]...; options go to the real cat
+static int fast_cat(char **argv, int in_fd, int out_fd) {
+    int rc = 0;
+    int i;
+
+    for (i = 1; argv[i]; i++) {
+        if (argv[i][0] == '-' && argv[i][1] != '\0') return FAST_DECLINE;
+    }
+    if (!argv[1]) {
+        if (copy_fd(in_fd, out_fd) != 0) {
+            fprintf(stderr, "cat: %s\n", strerror(errno));
+            return 1;
+        }
+        return 0;
+    }
+    for (i = 1; argv[i]; i++) {
+        int fd = in_fd;
+        if (strcmp(argv[i], "-") != 0) {
+            fd = open(argv[i], O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                fprintf(stderr, "cat: %s: %s\n", argv[i], strerror(errno));
+                rc = 1;
+                continue;
+            }
+        }
+        if (copy_fd(fd, out_fd) != 0) {
+            fprintf(stderr, "cat: %s: %s\n", argv[i], strerror(errno));
+            rc = 1;
+        }
+        if (fd != in_fd) close(fd);
+    }
+    return rc;
+}
+
+// Appends the printf escape at *p (just past the backslash); advances *p.
+// Returns FAST_DECLINE for the ones left to the real printf: \c, \e,
+// \x, \u, octal and a trailing backslash.
+static int printf_escape(outbuf_t *out, const char **p) {
+    const char *s = *p;
+    char c;
+
+    switch (*s) {
+    case 'n':  c = '\n'; break;
+    case 't':  c = '\t'; break;
+    case 'r':  c = '\r'; break;
+    case 'a':  c = '\a'; break;
+    case 'b':  c = '\b'; break;
+    case 'f':  c = '\f'; break;
+    case 'v':  c = '\v'; break;
+    case '\\': c = '\\'; break;
+    case '"':  c = '"';  break;
+    case '\0': case 'c': case 'e': case 'x': case 'u': case 'U':
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7':
+        return FAST_DECLINE;
+    default:
+        *p = s;
+        return outbuf_put(out, "\\", 1);
+    }
+    *p = s + 1;
+    return outbuf_put(out, &c, 1);
+}
+
+// printf format [args...]: %s %b %c %d %i %u %o %x %X %e %f %g %% with
+// flags, width and precision; the format repeats while arguments remain.
+// Anything whose output or message could differ from coreutils printf,
+// such as a bad number or a 'c character value, goes to the real one.
+static int fast_printf(char **argv, int in_fd, int out_fd) {
+    outbuf_t out = { NULL, 0, 0 };
+    char **arg;
+
+    (void)in_fd;
+    if (argv[1] && strncmp(argv[1], "--", 2) == 0) return FAST_DECLINE;
+    if (!argv[1]) {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+    arg = &argv[2];
+
+    do {
+        int consumed = 0;
+        for (const char *f = argv[1]; *f; ) {
+            char spec[32];
+            char tmp[512];
+            size_t sl = 0;
+            const char *a;
+            int n = 0;
+
+            if (*f == '\\') {
+                f++;
+                if (printf_escape(&out, &f) != 0) goto decline;
+                continue;
+            }
+            if (*f != '%') {
+                if (outbuf_put(&out, f++, 1) != 0) goto decline;
+                continue;
+            }
+            if (f[1] == '%') {
+                if (outbuf_put(&out, "%", 1) != 0) goto decline;
+                f += 2;
+                continue;
+            }
+
+            // Copy "%[flags][width][.prec]" and the conversion into spec
+            spec[sl++] = *f++;
+            while (*f && strchr("-+ #0123456789.", *f) && sl < sizeof(spec) - 3) spec[sl++] = *f++;
+            // %b takes no flags or width
+            if (!*f || *f == '*' || !strchr("sbcdiuoxXeEfFgG", *f) || (*f == 'b' && sl > 1)) {
+                goto decline;
+            }
+            a = *arg ? *arg++ : "";
+            consumed = 1;
+            if (strchr("diuoxXeEfFgG", *f) && (*a == '\'' || *a == '"')) goto decline;
+
+            switch (*f) {
+            case 's':
+                spec[sl++] = 's';
+                spec[sl] = '\0';
+                n = snprintf(tmp, sizeof(tmp), spec, a);
+                break;
+            case 'b':
+                // %b expands escapes in its argument and ignores width
+                while (*a) {
+                    if (*a == '\\') {
+                        a++;
+                        if (printf_escape(&out, &a) != 0) goto decline;
+                    } else if (outbuf_put(&out, a++, 1) != 0) {
+                        goto decline;
+                    }
+                }
+                f++;
+                continue;
+            case 'c':
+                spec[sl++] = 'c';
+                spec[sl] = '\0';
+                n = snprintf(tmp, sizeof(tmp), spec, *a);
+                break;
+            case 'd': case 'i': {
+                char *endp;
+                long long v;
+                errno = 0;
+                v = strtoll(a, &endp, 0);
+                if (*a && (*endp || errno)) goto decline;
+                spec[sl++] = 'l';
+                spec[sl++] = 'l';
+                spec[sl++] = *f;
+                spec[sl] = '\0';
+                n = snprintf(tmp, sizeof(tmp), spec, v);
+                break;
+            }
+            case 'u': case 'o': case 'x': case 'X': {
+                char *endp;
+                unsigned long long v;
+                errno = 0;
+                v = strtoull(a, &endp, 0);
+                if (*a && (*endp || errno)) goto decline;
+                spec[sl++] = 'l';
+                spec[sl++] = 'l';
+                spec[sl++] = *f;
+                spec[sl] = '\0';
+                n = snprintf(tmp, sizeof(tmp), spec, v);
+                break;
+            }
+            default: {
+                char *endp;
+                double v = strtod(a, &endp);
+                if (*a && *endp) goto decline;
+                spec[sl++] = *f;
+                spec[sl] = '\0';
+                n = snprintf(tmp, sizeof(tmp), spec, v);
+                break;
+            }
+            }
+            f++;
+
+            // Very wide fields are rare; let the real printf handle them
+            if (n < 0 || (size_t)n >= sizeof(tmp)) goto decline;
+            if (outbuf_put(&out, tmp, (size_t)n) != 0) goto decline;
+        }
+        if (!consumed) break;
+    } while (*arg);
+
+    return outbuf_flush(&out, out_fd, "printf");
+
+decline:
+    free(out.data);
+    return FAST_DECLINE;
+}
+
+static const fast_stage_t fast_stages[] = {
+    { "echo",   fast_echo },
+    { "cat",    fast_cat },
+    { "true",   fast_true },
+    { "false",  fast_false },
+    { "printf", fast_printf },
+};
+
+// Returns the in-process implementation of name, if fast paths are on
+stage_fn_t find_fast_stage(const char *name) {
+    size_t i;
+    if (!fastpath) return NULL;
+    for (i = 0; i < sizeof(fast_stages) / sizeof(fast_stages[0]); i++) {
+        if (strcmp(name, fast_stages[i].name) == 0) return fast_stages[i].fn;
+    }
+    return NULL;
+}
+
+static int is_regular(const char *path) {
+    struct stat st;
+    return stat(path, &st) != 0 || S_ISREG(st.st_mode);
+}
+
+// Whether everything cat would read is a regular file (or a here text),
+// which always reaches EOF. A missing file counts: cat just reports it.
+static int cat_reads_files(const command_t *cmd) {
+    const redir_t *in = find_redir(cmd, STDIN_FILENO);
+    int use_stdin = cmd->num_args == 1;
+    struct stat st;
+
+    for (int i = 1; i < cmd->num_args; i++) {
+        if (strcmp(cmd->args[i], "-") == 0) use_stdin = 1;
+        else if (!is_regular(cmd->args[i])) return 0;
+    }
+    if (!use_stdin || (in && in->here)) return 1;
+    if (in) return is_regular(in->file);
+    return fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// Runs a lone fast-path stage in the shell itself, with no fork at all.
+// Returns FAST_DECLINE if the command has to be launched after all.
+int run_fast_inline(const command_t *cmd, stage_fn_t fn) {
+    const int base[3] = { -1, -1, -1 };
+    int fds[3];
+    int opened[3];
+    int rc;
+
+    // Ctrl-C only stops a child, so a cat that could read for ever (a
+    // terminal, pipe, FIFO or device) runs in one
+    if (fn == fast_cat && !cat_reads_files(cmd)) return FAST_DECLINE;
+    // Its messages would go to the shell's own stderr
+    if (find_redir(cmd, STDERR_FILENO)) return FAST_DECLINE;
+    if (open_redirections(cmd, base, fds, opened) != 0) return 1;
+    rc = fn(cmd->args, fds[0] != -1 ? fds[0] : STDIN_FILENO,
+            fds[1] != -1 ? fds[1] : STDOUT_FILENO);
+    close_redirections(opened);
+    return rc;
+}
@@ -0,0 +1,312 @@
+// Pathname expansion: *, ? and [...] over a cache of sorted directory
+// listings, so scripts that glob the same big directories again and
+// again only pay for readdir when a directory changes
+
+#include "shell.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+// Sorted listing of one directory, reused while its mtime is unchanged
+typedef struct dir_index {
+    struct dir_index *next;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    char **names;       // Sorted byte-wise, pointing into store
+    int count;
+    char *store;
+} dir_index_t;
+
+static dir_index_t *dir_cache[GLOB_CACHE_BUCKETS];
+static int dir_cached;
+
+static void dir_index_free(dir_index_t *d) {
+    free(d->names);
+    free(d->store);
+    free(d);
+}
+
+// Drops every cached listing
+void glob_cache_clear(void) {
+    for (int i = 0; i < GLOB_CACHE_BUCKETS; i++) {
+        while (dir_cache[i]) {
+            dir_index_t *d = dir_cache[i];
+            dir_cache[i] = d->next;
+            dir_index_free(d);
+        }
+    }
+    dir_cached = 0;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Reads and sorts the entries of dir, minus . and ..
+static int dir_index_fill(dir_index_t *d, const char *dir) {
+    DIR *dp = opendir(dir);
+    struct dirent *de;
+    size_t used = 0, cap = 0;
+    int count = 0;
+    size_t off;
+
+    if (!dp) return -1;
+    while ((de = readdir(dp)) != NULL) {
+        size_t n = strlen(de->d_name) + 1;
+        if (de->d_name[0] == '.' && (n == 2 || (n == 3 && de->d_name[1] == '.'))) continue;
+        if (used + n > cap) {
+            char *grown;
+            cap = cap ? cap * 2 : 4096;
+            while (used + n > cap) cap *= 2;
+            grown = (char *)realloc(d->store, cap);
+            if (!grown) {
+                closedir(dp);
+                return -1;
+            }
+            d->store = grown;
+        }
+        memcpy(d->store + used, de->d_name, n);
+        used += n;
+        count++;
+    }
+    closedir(dp);
+
+    d->names = (char **)malloc((size_t)(count ? count : 1) * sizeof(char *));
+    if (!d->names) return -1;
+    off = 0;
+    for (int i = 0; i < count; i++) {
+        d->names[i] = d->store + off;
+        off += strlen(d->store + off) + 1;
+    }
+    qsort(d->names, (size_t)count, sizeof(char *), compare_names);
+    d->count = count;
+    return 0;
+}
+
+// Listing of dir, from the cache if the directory has not been modified
+// since it was read. Entries are keyed by device and inode, so a
+// relative path still finds the right one after cd.
+static const dir_index_t *dir_index_get(const char *dir) {
+    struct stat st;
+    dir_index_t **pp, *d;
+
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) return NULL;
+    pp = &dir_cache[(st.st_ino ^ st.st_dev) % GLOB_CACHE_BUCKETS];
+    for (d = *pp; d; pp = &d->next, d = d->next) {
+        if (d->ino != st.st_ino || d->dev != st.st_dev) continue;
+        if (d->mtime.tv_sec == st.st_mtim.tv_sec && d->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            return d;
+        }
+        // Stale: unlink it and read the directory again
+        *pp = d->next;
+        dir_index_free(d);
+        dir_cached--;
+        break;
+    }
+
+    if (dir_cached >= GLOB_CACHE_MAX) glob_cache_clear();
+    d = (dir_index_t *)calloc(1, sizeof(*d));
+    if (!d) return NULL;
+    if (dir_index_fill(d, dir) != 0) {
+        dir_index_free(d);
+        return NULL;
+    }
+    d->dev = st.st_dev;
+    d->ino = st.st_ino;
+    d->mtime = st.st_mtim;
+    pp = &dir_cache[(st.st_ino ^ st.st_dev) % GLOB_CACHE_BUCKETS];
+    d->next = *pp;
+    *pp = d;
+    dir_cached++;
+    return d;
+}
+
+// Matches c against the [...] class at p, just past the '['. Returns the
+// pattern bytes up to and including the ']', 0 for no match, or -1 if
+// the class is never closed and the '[' is literal.
+static int match_class(const char *p, unsigned char c) {
+    const char *q = p;
+    int negate = 0, found = 0;
+
+    if (*q == '!' || *q == '^') {
+        negate = 1;
+        q++;
+    }
+    // A ']' right at the start is a member, not the end
+    for (int first = 1; *q && (first || *q != ']'); first = 0) {
+        unsigned char lo, hi;
+        if (*q == GLOB_MARK) {
+            q++;
+            continue;
+        }
+        lo = hi = (unsigned char)*q++;
+        if (q[0] == '-' && q[1] && q[1] != ']') {
+            hi = (unsigned char)q[1];
+            q += 2;
+        }
+        if (c >= lo && c <= hi) found = 1;
+    }
+    if (*q != ']') return -1;
+    return found != negate ? (int)(q + 1 - p) : 0;
+}
+
+// Matches one pattern component against a name. Wildcards are the
+// bytes after a GLOB_MARK; everything else is literal. A '*' is
+// retried from the last star only, so there is no backtracking blowup.
+static int glob_match(const char *p, const char *s) {
+    const char *star_p = NULL, *star_s = NULL;
+
+    while (*s) {
+        if (p[0] == GLOB_MARK && p[1] == '*') {
+            p += 2;
+            star_p = p;
+            star_s = s;
+            continue;
+        }
+        if (p[0] == GLOB_MARK && p[1] == '?') {
+            p += 2;
+            s++;
+            continue;
+        }
+        if (p[0] == GLOB_MARK && p[1] == '[') {
+            int n = match_class(p + 2, (unsigned char)*s);
+            if (n > 0) {
+                p += 2 + n;
+                s++;
+                continue;
+            }
+            if (n < 0 && *s == '[') {
+                p += 2;
+                s++;
+                continue;
+            }
+        } else if (*p == *s) {
+            p++;
+            s++;
+            continue;
+        }
+        if (!star_p) return 0;
+        p = star_p;
+        s = ++star_s;
+    }
+    while (p[0] == GLOB_MARK && p[1] == '*') p += 2;
+    return *p == '\0';
+}
+
+// Expansion state: the path built so far and the matches found
+typedef struct {
+    arena_t *a;
+    char path[PATH_MAX];
+    char **matches;     // Arena strings, in a malloc'd array
+    int count;
+    int cap;
+} glob_state_t;
+
+static int glob_add(glob_state_t *g, size_t len) {
+    char *copy;
+
+    if (g->count == g->cap) {
+        int cap = g->cap ? g->cap * 2 : 16;
+        char **grown = (char **)realloc(g->matches, (size_t)cap * sizeof(char *));
+        if (!grown) return -1;
+        g->matches = grown;
+        g->cap = cap;
+    }
+    copy = (char *)arena_alloc(g->a, len + 1);
+    if (!copy) return -1;
+    memcpy(copy, g->path, len);
+    copy[len] = '\0';
+    g->matches[g->count++] = copy;
+    return 0;
+}
+
+// Matches pat, the components still to go, below g->path[0, len).
+// Components without wildcards are appended without reading anything.
+static int glob_walk(glob_state_t *g, size_t len, const char *pat) {
+    const char *slash = strchr(pat, '/');
+    size_t clen = slash ? (size_t)(slash - pat) : strlen(pat);
+    char comp[NAME_MAX * 2 + 2];
+    const dir_index_t *d;
+    size_t plen;
+    int lo, hi;
+
+    if (clen >= sizeof(comp)) return 0;
+    memcpy(comp, pat, clen);
+    comp[clen] = '\0';
+
+    if (!memchr(comp, GLOB_MARK, clen)) {
+        struct stat st;
+        if (len + clen + 2 > sizeof(g->path)) return 0;
+        memcpy(g->path + len, comp, clen);
+        len += clen;
+        if (slash) {
+            g->path[len++] = '/';
+            return glob_walk(g, len, slash + 1);
+        }
+        g->path[len] = '\0';
+        return lstat(g->path, &st) == 0 ? glob_add(g, len) : 0;
+    }
+
+    g->path[len] = '\0';
+    d = dir_index_get(len ? g->path : ".");
+    if (!d) return 0;
+
+    // The names are sorted, so a literal prefix narrows them down to one
+    // run found by binary search
+    plen = strcspn(comp, "\002");
+    lo = 0;
+    hi = d->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strncmp(d->names[mid], comp, plen) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for (int i = lo; i < d->count && strncmp(d->names[i], comp, plen) == 0; i++) {
+        const char *name = d->names[i];
+        size_t nlen = strlen(name);
+
+        // Dot files only match a pattern that starts with a literal dot
+        if (name[0] == '.' && comp[0] != '.') continue;
+        if (!glob_match(comp, name)) continue;
+        if (len + nlen + 2 > sizeof(g->path)) continue;
+        memcpy(g->path + len, name, nlen);
+        if (!slash) {
+            if (glob_add(g, len + nlen) != 0) return -1;
+        } else if (slash[1] == '\0') {
+            // A trailing slash only matches directories
+            struct stat st;
+            g->path[len + nlen] = '\0';
+            if (stat(g->path, &st) == 0 && S_ISDIR(st.st_mode)) {
+                g->path[len + nlen] = '/';
+                if (glob_add(g, len + nlen + 1) != 0) return -1;
+            }
+        } else {
+            g->path[len + nlen] = '/';
+            if (glob_walk(g, len + nlen + 1, slash + 1) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+// Expands a word holding GLOB_MARK wildcards into the paths it matches,
+// sorted directory by directory. *matches is malloc'd and the strings
+// live in a. Returns the number of matches, or -1 when out of memory.
+int glob_word(arena_t *a, const char *word, char ***matches) {
+    glob_state_t g;
+    size_t len = 0;
+
+    memset(&g, 0, sizeof(g));
+    g.a = a;
+    if (word[0] == '/') {
+        g.path[len++] = '/';
+        while (*word == '/') word++;
+    }
+    if (glob_walk(&g, len, word) != 0) {
+        free(g.matches);
+        return -1;
+    }
+    *matches = g.matches;
+    return g.count;
+}
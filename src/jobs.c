@@ -0,0 +1,369 @@
+// Job table, reaping, `time` reports and foreground waits
+
+#include "shell.h"
+
+#include <sys/wait.h>
+
+job_t *job_table;
+int job_control;                // Interactive: jobs get their own process groups
+pid_t shell_pgid;
+struct termios shell_tmodes;
+int pipefail;                   // Status is the rightmost failing stage's
+int failfast;                   // Kill the rest of a pipeline when a stage fails
+int *pipe_status;               // Per stage statuses of the last foreground job
+int pipe_status_count;
+
+// Adds a job to the table; tracked jobs get the next free number
+void job_register(job_t *job, int tracked) {
+    job_t **pp = &job_table;
+    int id = 0;
+
+    while (*pp) {
+        if ((*pp)->id > id) id = (*pp)->id;
+        pp = &(*pp)->next;
+    }
+    job->id = tracked ? id + 1 : 0;
+    job->next = NULL;
+    *pp = job;
+}
+
+void job_unregister(job_t *job) {
+    job_t **pp = &job_table;
+    while (*pp && *pp != job) pp = &(*pp)->next;
+    if (*pp) *pp = job->next;
+}
+
+// Unlinks and frees a job allocated by execute_pipeline
+void job_free(job_t *job) {
+    job_unregister(job);
+    if (job->errtag) errtag_close(job->errtag);
+    arena_destroy(&job->arena);
+    free(job);
+}
+
+// failfast: stops the stages still running once one has failed, so
+// downstream work does not run on until EOF
+static void job_teardown(job_t *job) {
+    job->torn_down = 1;
+    for (int i = 0; i < job->nprocs; i++) {
+        if (job->pids[i] <= 0) continue;
+        kill(job->pids[i], SIGTERM);
+        if (job->stopped[i]) kill(job->pids[i], SIGCONT);
+    }
+}
+
+// Applies one wait status to the job owning pid; returns that job. A
+// fan-out helper only counts while it runs: its consumers' statuses are
+// not the pipeline's, as with bash's process substitution. memo's helper
+// only tells whether its capture is complete.
+static job_t *job_update(pid_t pid, int status, const struct rusage *ru) {
+    for (job_t *job = job_table; job; job = job->next) {
+        for (int i = 0; i < job->nprocs; i++) {
+            if (job->pids[i] != pid) continue;
+            if (WIFSTOPPED(status)) {
+                if (!job->stopped[i]) job->nstopped++;
+                job->stopped[i] = 1;
+            } else if (WIFCONTINUED(status)) {
+                if (job->stopped[i]) job->nstopped--;
+                job->stopped[i] = 0;
+            } else {
+                if (job->stopped[i]) job->nstopped--;
+                job->pids[i] = -1;
+                job->nalive--;
+                if (i < job->plan->num_cmds) {
+                    if (WIFSIGNALED(status)) job->term_sig = WTERMSIG(status);
+                    job->statuses[i] = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+                    // A writer killed by SIGPIPE only means its reader finished first
+                    if (job->statuses[i] != 0 && job->failed < 0 && !job->torn_down &&
+                        !(WIFSIGNALED(status) && WTERMSIG(status) == SIGPIPE)) {
+                        job->failed = i;
+                        if (failfast && job->nalive > 0) job_teardown(job);
+                    }
+                    if (job->usage) {
+                        job->usage[i].status = status;
+                        job->usage[i].ru = *ru;
+                        clock_gettime(CLOCK_MONOTONIC, &job->usage[i].reaped);
+                    }
+                }
+                if (job->memo && pid == job->memo->pid) {
+                    job->memo->complete = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+                }
+                if (job->nalive == 0) {
+                    clock_gettime(CLOCK_MONOTONIC, &job->finished);
+                    if (job->memo) memo_end(job);
+                    trace_job(job);
+                }
+                if (i < job->plan->num_cmds && WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+                    path_cache_check(&job->plan->cmds[i]);
+                }
+            }
+            return job;
+        }
+    }
+    return NULL;
+}
+
+// Exit status of a finished job: the last stage's, or with pipefail the
+// rightmost stage that failed. After a failfast teardown the stages we
+// killed do not count; the one that failed first does.
+int job_result(const job_t *job) {
+    int n = job->plan->num_cmds;
+
+    if (job->torn_down) return job->statuses[job->failed];
+    if (!pipefail) return job->statuses[n - 1];
+    for (int i = n - 1; i >= 0; i--) {
+        if (job->statuses[i] != 0) return job->statuses[i];
+    }
+    return 0;
+}
+
+// Records what $PIPESTATUS reports
+void set_pipe_status(const int *statuses, int n) {
+    if (n > pipe_status_count) {
+        int *grown = (int *)realloc(pipe_status, (size_t)n * sizeof(int));
+        if (!grown) return;
+        pipe_status = grown;
+    }
+    memcpy(pipe_status, statuses, (size_t)n * sizeof(int));
+    pipe_status_count = n;
+}
+
+// Waits for any child with wait4 so `time` gets its rusage for free.
+// Returns the pid (0 or -1 as waitpid would) and the job it belonged to.
+pid_t reap_child(int options, int *status, job_t **job) {
+    struct rusage ru;
+    pid_t pid = wait4(-1, status, options, &ru);
+    *job = pid > 0 ? job_update(pid, *status, &ru) : NULL;
+    return pid;
+}
+
+// Collects every child that changed state without blocking
+void reap_jobs(void) {
+    int status;
+    job_t *job;
+
+    child_exited = 0;
+    while (reap_child(WNOHANG | WUNTRACED | WCONTINUED, &status, &job) > 0) {}
+}
+
+static const char *job_state(const job_t *job) {
+    if (job->nalive == 0) return "Done";
+    if (job->nstopped == job->nalive) return "Stopped";
+    return "Running";
+}
+
+void print_job(const job_t *job) {
+    const char *state = job_state(job);
+    printf("[%d]%c  %-24s%s%s\n", job->id, job->next ? ' ' : '+', state,
+           job->cmdline, state[0] == 'R' ? " &" : "");
+}
+
+double timespec_diff(const struct timespec *end, const struct timespec *start) {
+    return (double)(end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+double timeval_secs(const struct timeval *tv) {
+    return (double)tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+// Writes s as a JSON string literal
+void json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c < 0x20) fprintf(out, "\\u%04x", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+// Prints the `time` report for a finished job to stderr: wall time for
+// the pipeline, then CPU, memory and scheduling figures per stage
+void report_times(const job_t *job) {
+    double real = timespec_diff(&job->finished, &job->started);
+    int n = job->plan->num_cmds;
+
+    if (job->plan->timed == TIME_MACHINE) {
+        fprintf(stderr, "{\"real\":%.6f,\"stages\":[", real);
+        for (int i = 0; i < n; i++) {
+            const stage_usage_t *u = &job->usage[i];
+            int st = u->status;
+            fprintf(stderr, "%s{\"argv0\":", i ? "," : "");
+            json_string(stderr, job->plan->cmds[i].args[0]);
+            fprintf(stderr, ",\"pid\":%d,\"status\":%d,\"signal\":%d,"
+                    "\"user\":%.6f,\"sys\":%.6f,\"maxrss_kb\":%ld,"
+                    "\"nvcsw\":%ld,\"nivcsw\":%ld,\"minflt\":%ld,\"majflt\":%ld}",
+                    (int)u->pid, WIFEXITED(st) ? WEXITSTATUS(st) : -1,
+                    WIFSIGNALED(st) ? WTERMSIG(st) : 0,
+                    timeval_secs(&u->ru.ru_utime), timeval_secs(&u->ru.ru_stime),
+                    u->ru.ru_maxrss, u->ru.ru_nvcsw, u->ru.ru_nivcsw,
+                    u->ru.ru_minflt, u->ru.ru_majflt);
+        }
+        fprintf(stderr, "]}\n");
+        return;
+    }
+
+    fprintf(stderr, "\nreal  %8.3fs\n", real);
+    for (int i = 0; i < n; i++) {
+        const stage_usage_t *u = &job->usage[i];
+        if (u->pid <= 0) {
+            fprintf(stderr, "[%d] %-12s %s\n", i + 1, job->plan->cmds[i].args[0],
+                    job->cached ? "cached" : "not started");
+            continue;
+        }
+        fprintf(stderr, "[%d] %-12s user %7.3fs  sys %7.3fs  maxrss %7ld KB"
+                "  vcsw %ld  ivcsw %ld  minflt %ld  majflt %ld\n",
+                i + 1, job->plan->cmds[i].args[0],
+                timeval_secs(&u->ru.ru_utime), timeval_secs(&u->ru.ru_stime),
+                u->ru.ru_maxrss, u->ru.ru_nvcsw, u->ru.ru_nivcsw,
+                u->ru.ru_minflt, u->ru.ru_majflt);
+    }
+}
+
+// Reports and drops background jobs that have finished
+void notify_jobs(void) {
+    job_t *job = job_table;
+
+    if (child_exited) reap_jobs();
+    while (job) {
+        job_t *next = job->next;
+        // A tagged job sent on with bg is only drained here
+        if (job->errtag) errtag_drain(job->errtag, 0, NULL);
+        if (job->id && job->nalive == 0) {
+            if (job_control) print_job(job);
+            if (job->plan->timed != TIME_NONE) report_times(job);
+            job_free(job);
+        }
+        job = next;
+    }
+    fflush(stdout);
+}
+
+// Waits until job has exited or stopped. With job control it owns the
+// terminal meanwhile; a stage that stopped on tty access before the
+// handover is simply continued.
+static void wait_foreground(job_t *job) {
+    int options = job_control ? WUNTRACED : 0;
+    sigset_t chld, old;
+
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    if (job_control && job->pgid) tcsetpgrp(STDIN_FILENO, job->pgid);
+
+    while (job->nalive > job->nstopped) {
+        int status;
+        job_t *owner;
+        pid_t pid = 0;
+
+        // stderrtag: sleep in epoll on the stages' stderr instead. SIGCHLD
+        // stays blocked until epoll_pwait lets it in, so one that arrives
+        // first still wakes it.
+        if (job->errtag) {
+            int drained;
+            sigprocmask(SIG_BLOCK, &chld, &old);
+            pid = reap_child(options | WNOHANG, &status, &owner);
+            drained = pid == 0 && errtag_drain(job->errtag, -1, &old) == 0;
+            sigprocmask(SIG_SETMASK, &old, NULL);
+            if (drained) continue;
+        }
+        if (pid == 0) pid = reap_child(options, &status, &owner);
+        if (pid == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (owner == job && WIFSTOPPED(status) &&
+            (WSTOPSIG(status) == SIGTTIN || WSTOPSIG(status) == SIGTTOU)) {
+            kill(pid, SIGCONT);
+        }
+    }
+    if (job->nalive == 0 && job->errtag) {
+        errtag_close(job->errtag);
+        job->errtag = NULL;
+    }
+
+    if (job_control) {
+        tcsetpgrp(STDIN_FILENO, shell_pgid);
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
+    }
+}
+
+// Runs a job in the foreground and sets last_status. Returns 1 if it
+// stopped and stays in the table, 0 once it is finished and freed.
+int foreground_job(job_t *job) {
+    job->background = 0;
+    wait_foreground(job);
+    if (job->nalive > 0) {
+        last_status = 128 + SIGTSTP;
+        job->background = 1;
+        putchar('\n');
+        print_job(job);
+        fflush(stdout);
+        return 1;
+    }
+    // Keep the prompt off the line where ^C was echoed
+    if (job_control && job->term_sig == SIGINT) putchar('\n');
+    last_status = job_result(job);
+    set_pipe_status(job->statuses, job->plan->num_cmds);
+    if (job->plan->timed != TIME_NONE) report_times(job);
+    job_free(job);
+    return 0;
+}
+
+// Runs a parsed pipeline and returns its status, also kept in
+// last_status. Its plan lives in arena a, which the job takes over if it
+// has to outlive the current line.
+int execute_pipeline(arena_t *a, const pipeline_t *plan, const char *cmdline) {
+    // Traced and tagged runs fork even these, so every stage gets its
+    // record and its stderr prefix; `sched` needs a process to apply to
+    if (plan->num_cmds == 1 && !plan->background && plan->timed == TIME_NONE &&
+        !plan->memo && trace_fd == -1 && !stderr_tag && !plan->cmds[0].num_fanout &&
+        !plan->sched && !plan->cmds[0].sched) {
+        stage_fn_t fn = find_fast_stage(plan->cmds[0].args[0]);
+        int rc = fn ? run_fast_inline(&plan->cmds[0], fn) : FAST_DECLINE;
+        if (rc != FAST_DECLINE) {
+            set_pipe_status(&rc, 1);
+            return last_status = rc;
+        }
+    }
+
+    job_t *job = (job_t *)calloc(1, sizeof(job_t));
+    // The caller's plan header may be on its stack; the job needs its own
+    pipeline_t *pl = (pipeline_t *)arena_alloc(a, sizeof(*pl));
+    if (!job || !pl) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        free(job);
+        return last_status = 1;
+    }
+    *pl = *plan;
+    if (launch_pipeline(a, pl, NULL, job) != 0) {
+        free(job);
+        return last_status = 1;
+    }
+    if (job->nalive == 0) {
+        last_status = job_result(job);
+        set_pipe_status(job->statuses, pl->num_cmds);
+        if (pl->timed != TIME_NONE) report_times(job);
+        free(job);
+        return last_status;
+    }
+    job->cmdline = cmdline;
+    job_register(job, 1);
+
+    if (pl->background) {
+        job->background = 1;
+        job->arena = *a;
+        memset(a, 0, sizeof(*a));
+        if (job_control) {
+            printf("[%d] %d\n", job->id, (int)job->pgid);
+            fflush(stdout);
+        }
+        return last_status = 0;
+    }
+
+    if (foreground_job(job)) {
+        job->arena = *a;
+        memset(a, 0, sizeof(*a));
+    }
+    return last_status;
+}
@@ -0,0 +1,624 @@
+// Starting pipeline stages: fork, vfork or posix_spawn backends
+
+#include "shell.h"
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+int launch_mode = LAUNCH_SPAWN;
+int pipe_size;                  // Requested pipe buffer bytes, 0 for the kernel default
+int pipe_granted;               // What the kernel gave the last pipe we created
+int pipe_direct;                // Packet-mode pipes (O_DIRECT)
+int xargs_split;                // Split argv lists too big for one exec
+
+// Bytes an exec of words takes out of ARG_MAX: the strings plus the
+// pointers to them
+static size_t argv_bytes(char *const *words, int n) {
+    size_t size = sizeof(char *);
+    for (int i = 0; i < n; i++) size += strlen(words[i]) + 1 + sizeof(char *);
+    return size;
+}
+
+// Room for arguments in one exec, after the environment
+static size_t exec_arg_room(void) {
+    long max = sysconf(_SC_ARG_MAX);
+    size_t env = 0;
+    size_t room;
+
+    if (max <= 0) max = 128 * 1024;
+    for (char **e = environ; *e; e++) env += strlen(*e) + 1 + sizeof(char *);
+    room = (size_t)max - EXEC_ARG_HEADROOM;
+    return env < room ? room - env : 0;
+}
+
+// xargs: the words repeated on every exec; the command and its leading
+// options, up to and including a "--"
+static int split_prefix(const command_t *cmd) {
+    int n = 1;
+    while (n < cmd->num_args && cmd->args[n][0] == '-' && cmd->args[n][1] != '\0') {
+        if (strcmp(cmd->args[n++], "--") == 0) break;
+    }
+    return n;
+}
+
+// Child side of a split stage: runs the command once per batch of
+// arguments that fits in an exec, one after the other on the same
+// stdin and stdout. Exit status follows xargs: 123 if any run failed,
+// 125 if one was killed, 126 or 127 if the command could not be run.
+static int exec_split(const command_t *cmd) {
+    size_t room = exec_arg_room();
+    int fixed = split_prefix(cmd);
+    size_t base = argv_bytes(cmd->args, fixed);
+    char **argv = (char **)malloc(((size_t)cmd->num_args + 1) * sizeof(char *));
+    int next = fixed;
+    int failed = 0;
+
+    if (!argv) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return 126;
+    }
+    memcpy(argv, cmd->args, (size_t)fixed * sizeof(char *));
+    while (next < cmd->num_args) {
+        size_t size = base;
+        int n = fixed;
+        int status;
+        pid_t pid;
+
+        // Every run gets at least one argument, even an oversized one
+        while (next < cmd->num_args) {
+            size_t word = strlen(cmd->args[next]) + 1 + sizeof(char *);
+            if (n > fixed && size + word > room) break;
+            size += word;
+            argv[n++] = cmd->args[next++];
+        }
+        argv[n] = NULL;
+
+        pid = fork();
+        if (pid == 0) {
+            if (cmd->path) execv(cmd->path, argv);
+            else execvp(argv[0], argv);
+            fprintf(stderr, "Error: exec() failed. %s.\n", strerror(errno));
+            _exit(errno == ENOENT ? 127 : 126);
+        }
+        if (pid < 0) {
+            fprintf(stderr, "Error: fork() failed. %s.\n", strerror(errno));
+            return 126;
+        }
+        while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {}
+        if (WIFSIGNALED(status)) return 125;
+        if (WEXITSTATUS(status) == 126 || WEXITSTATUS(status) == 127) return WEXITSTATUS(status);
+        if (WEXITSTATUS(status) != 0) failed = 1;
+    }
+    return failed ? 123 : 0;
+}
+
+// Child side of the fork backend: wires up fds and execs
+static void exec_stage(const command_t *cmd, const stage_io_t *io) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    if (io->pgid >= 0) {
+        setpgid(0, io->pgid);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+    }
+    if (io->sched) sched_apply(io->sched);
+
+    for (int k = 0; k < 3; k++) {
+        if (io->fds[k] != -1) dup2(io->fds[k], k);
+    }
+    // The originals are close-on-exec, but fast-path stages never exec.
+    // That includes pipe ends a redirection took the place of, and a
+    // stage holding its own reader's end would never see EPIPE once that
+    // reader exits.
+    for (int k = 0; k < 3; k++) {
+        if (io->fds[k] > STDERR_FILENO) close(io->fds[k]);
+    }
+    if (io->in_fd > STDERR_FILENO) close(io->in_fd);
+    if (io->out_fd > STDERR_FILENO) close(io->out_fd);
+    if (io->err_fd > STDERR_FILENO) close(io->err_fd);
+    if (io->close_fd != -1) close(io->close_fd);
+
+    // Fast-path stages run right here in the forked child
+    if (cmd->fast) {
+        int rc = cmd->fast(cmd->args, STDIN_FILENO, STDOUT_FILENO);
+        if (rc != FAST_DECLINE) _exit(rc);
+    }
+    if (cmd->split) _exit(exec_split(cmd));
+
+    if (cmd->path) {
+        execv(cmd->path, cmd->args);
+    } else {
+        execvp(cmd->args[0], cmd->args);
+    }
+    fprintf(stderr, "Error: exec() failed. %s.\n", strerror(errno));
+    _exit(errno == ENOENT ? 127 : 126);
+}
+
+// Descriptor that reads the text of a here-document, close-on-exec. Text
+// that fits in a pipe's buffer is written into one right away; anything
+// bigger goes into a sealed memfd, so no temporary file touches a disk
+// either way. Returns -1 after reporting a failure.
+int here_fd(const char *text) {
+    size_t len = strlen(text);
+    int fds[2];
+    int fd;
+
+    if (pipe2(fds, O_CLOEXEC) == 0) {
+        int room = fcntl(fds[1], F_GETPIPE_SZ);
+        int ok = room > 0 && len <= (size_t)room && write_all(fds[1], text, len) == 0;
+        close(fds[1]);
+        if (ok) return fds[0];
+        close(fds[0]);
+    }
+
+    fd = memfd_create("here-document", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1 || write_all(fd, text, len) != 0 ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0 ||
+        lseek(fd, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "Error: Cannot create here-document. %s.\n", strerror(errno));
+        if (fd != -1) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// cmd's redirection of fd, or NULL if it leaves fd alone
+const redir_t *find_redir(const command_t *cmd, int fd) {
+    for (int i = 0; i < cmd->num_redirs; i++) {
+        if (cmd->redirs[i].fd == fd) return &cmd->redirs[i];
+    }
+    return NULL;
+}
+
+// Works out what a stage's fds 0, 1 and 2 become: base[k] (-1 for the
+// shell's own fd k) with cmd's redirections applied in source order, so
+// 2>&1 >file and >file 2>&1 differ as in sh. Targets are opened in the
+// shell, close-on-exec, and one of the shell's own fds 0-2 that has to
+// move gets a copy above 2, so fds can be dup2'd onto 0, 1 and 2 in any
+// order; -1 leaves an fd alone. What was opened goes in opened for
+// close_redirections. Returns -1 after reporting a failure, with
+// nothing left open.
+int open_redirections(const command_t *cmd, const int base[3], int fds[3], int opened[3]) {
+    int n = 0;
+
+    for (int k = 0; k < 3; k++) {
+        fds[k] = base[k] != -1 ? base[k] : k;
+        opened[k] = -1;
+    }
+    for (int i = 0; i < cmd->num_redirs; i++) {
+        const redir_t *r = &cmd->redirs[i];
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (r->append ? O_APPEND : O_TRUNC);
+        int fd;
+
+        if (r->dup != -1) {
+            fds[r->fd] = fds[r->dup];
+            continue;
+        }
+        if (r->here) {
+            fd = here_fd(r->here);
+        } else {
+            fd = open(r->file, r->fd == STDIN_FILENO ? O_RDONLY | O_CLOEXEC : flags, 0644);
+            if (fd == -1) {
+                fprintf(stderr, "Error: Cannot open %s file '%s'. %s.\n",
+                        r->fd == STDIN_FILENO ? "input" : "output", r->file, strerror(errno));
+            }
+        }
+        if (fd == -1) {
+            close_redirections(opened);
+            return -1;
+        }
+        fds[r->fd] = opened[n++] = fd;
+    }
+    for (int k = 0; k < 3; k++) {
+        if (fds[k] == k) {
+            fds[k] = -1;
+        } else if (fds[k] <= STDERR_FILENO) {
+            int fd = fcntl(fds[k], F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+            if (fd == -1) {
+                fprintf(stderr, "Error: Cannot duplicate file descriptor %d. %s.\n",
+                        fds[k], strerror(errno));
+                close_redirections(opened);
+                return -1;
+            }
+            fds[k] = opened[n++] = fd;
+        }
+    }
+    return 0;
+}
+
+// Closes what open_redirections opened
+void close_redirections(int opened[3]) {
+    for (int k = 0; k < 3; k++) {
+        if (opened[k] != -1) close(opened[k]);
+        opened[k] = -1;
+    }
+}
+
+// posix_spawn backend. The stage's fds were worked out in the shell, so
+// they only need handing to the child as file actions.
+static pid_t spawn_stage(const command_t *cmd, const stage_io_t *io, int *status) {
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    pid_t pid = -1;
+    int rc;
+
+    rc = posix_spawnattr_init(&attr);
+    if (rc == 0) {
+        // Signals the shell ignores must not stay ignored: SIGPIPE under
+        // --serve, the job control ones in an interactive shell
+        sigset_t defaults;
+        short flags = POSIX_SPAWN_SETSIGDEF;
+        sigemptyset(&defaults);
+        sigaddset(&defaults, SIGPIPE);
+        if (io->pgid >= 0) {
+            sigaddset(&defaults, SIGTSTP);
+            sigaddset(&defaults, SIGTTIN);
+            sigaddset(&defaults, SIGTTOU);
+            posix_spawnattr_setpgroup(&attr, io->pgid);
+            flags |= POSIX_SPAWN_SETPGROUP;
+        }
+        posix_spawnattr_setsigdefault(&attr, &defaults);
+        rc = posix_spawnattr_setflags(&attr, flags);
+    }
+    if (rc == 0) rc = posix_spawn_file_actions_init(&fa);
+    if (rc == 0) {
+        // Everything else the shell holds is O_CLOEXEC, and dup2 clears it
+        for (int k = 0; rc == 0 && k < 3; k++) {
+            if (io->fds[k] != -1) rc = posix_spawn_file_actions_adddup2(&fa, io->fds[k], k);
+        }
+        if (rc == 0 && cmd->path) {
+            rc = posix_spawn(&pid, cmd->path, &fa, &attr, cmd->args, environ);
+        } else if (rc == 0) {
+            rc = posix_spawnp(&pid, cmd->args[0], &fa, &attr, cmd->args, environ);
+        }
+        posix_spawn_file_actions_destroy(&fa);
+    }
+    posix_spawnattr_destroy(&attr);
+
+    if (rc != 0) {
+        fprintf(stderr, "Error: exec() failed. %s.\n", strerror(rc));
+        if (rc == ENOENT) path_cache_check(cmd);
+        else *status = 126;
+        return -1;
+    }
+    return pid;
+}
+
+// vfork backend. The child shares our memory and stack until it execs,
+// so it does nothing but dup2 and exec: its fds were worked out in the
+// shell as for spawn_stage, and an exec failure is left in exec_errno
+// for the parent to report once the child is gone.
+static pid_t vfork_stage(const command_t *cmd, const stage_io_t *io) {
+    static volatile int exec_errno;
+    pid_t pid;
+
+    exec_errno = 0;
+    pid = vfork();
+    if (pid == 0) {
+        // Everything else the shell holds is O_CLOEXEC, and dup2 clears it
+        for (int k = 0; k < 3; k++) {
+            if (io->fds[k] != -1) dup2(io->fds[k], k);
+        }
+        if (cmd->path) {
+            execv(cmd->path, cmd->args);
+        } else {
+            execvp(cmd->args[0], cmd->args);
+        }
+        exec_errno = errno;
+        _exit(errno == ENOENT ? 127 : 126);
+    }
+
+    if (pid < 0) {
+        fprintf(stderr, "Error: vfork() failed. %s.\n", strerror(errno));
+    } else if (exec_errno) {
+        fprintf(stderr, "Error: exec() failed. %s.\n", strerror(exec_errno));
+        if (exec_errno == ENOENT) path_cache_check(cmd);
+    }
+    return pid;
+}
+
+// Whether the shell ignores SIGPIPE (it does under --serve), which a
+// stage has to have put back before exec
+static int sigpipe_ignored(void) {
+    struct sigaction sa;
+    return sigaction(SIGPIPE, NULL, &sa) == 0 && sa.sa_handler == SIG_IGN;
+}
+
+// Starts one stage with the selected backend; returns its pid, or -1
+// with *status set to what the stage counts as having exited with
+static pid_t launch_stage(const command_t *cmd, const stage_io_t *io, int *status) {
+    pid_t pid;
+
+    // Fast-path and split stages need a real copy of the shell, so they
+    // always fork. posix_spawn has no attribute for affinity or
+    // priorities, so a `sched` stage forks too.
+    if (launch_mode == LAUNCH_SPAWN && !cmd->fast && !cmd->split && !io->sched) {
+        return spawn_stage(cmd, io, status);
+    }
+    // A vfork child may not set up anything beyond its fds: no sched
+    // settings, process group or signal dispositions
+    if (launch_mode == LAUNCH_VFORK && !cmd->fast && !cmd->split && !io->sched &&
+        io->pgid < 0 && !sigpipe_ignored()) {
+        return vfork_stage(cmd, io);
+    }
+
+    pid = fork();
+    if (pid == 0) {
+        exec_stage(cmd, io);
+    }
+    if (pid < 0) {
+        fprintf(stderr, "Error: fork() failed. %s.\n", strerror(errno));
+    }
+    // Set the group from both sides so neither races the other
+    if (pid > 0 && io->pgid >= 0) {
+        setpgid(pid, io->pgid ? io->pgid : pid);
+    }
+    return pid;
+}
+
+// Creates a pipe between two stages, applying the pipesize and
+// pipedirect options. A size the kernel refuses (above
+// /proc/sys/fs/pipe-max-size for unprivileged users) keeps the default;
+// either way the size actually in effect is recorded in pipe_granted.
+static int make_pipe(int pipefd[2]) {
+    int flags = O_CLOEXEC | (pipe_direct ? O_DIRECT : 0);
+
+    if (pipe2(pipefd, flags) == -1) return -1;
+    if (pipe_size > 0) fcntl(pipefd[1], F_SETPIPE_SZ, pipe_size);
+    pipe_granted = fcntl(pipefd[1], F_GETPIPE_SZ);
+    return 0;
+}
+
+// Points a stage with >(...) consumers at a pipe of its own and starts
+// the helper that copies that pipe to them and on to where the stage's
+// output was going, its > file included. Returns the helper's pid, or
+// -1 after reporting a failure.
+static pid_t start_fanout(const command_t *cmd, stage_io_t *io, const int *std_fds) {
+    const redir_t *r = find_redir(cmd, STDOUT_FILENO);
+    const char *file = r ? r->file : NULL;
+    int dest = io->out_fd;
+    int fds[2];
+    pid_t pid;
+
+    if (file) {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (r->append ? O_APPEND : O_TRUNC);
+        dest = open(file, flags, 0644);
+        if (dest == -1) {
+            fprintf(stderr, "Error: Cannot open output file '%s'. %s.\n", file, strerror(errno));
+            return -1;
+        }
+    }
+    if (make_pipe(fds) == -1) {
+        fprintf(stderr, "Error: pipe() failed. %s.\n", strerror(errno));
+        if (file) close(dest);
+        return -1;
+    }
+
+    io->out_fd = fds[1];
+    pid = launch_fanout(cmd, fds[0], dest, std_fds, io);
+    close(fds[0]);
+    if (file) close(dest);
+    if (pid < 0) {
+        close(fds[1]);
+        return -1;
+    }
+    return pid;
+}
+
+// Settings stage i of pl runs with: the pipeline's `sched`, with the
+// stage's own overriding what it sets, and with spread (or set -o
+// affinity=spread) resolved to one CPU per stage, counted from the
+// pipeline's place in the spread order in *base (-1 until the first
+// spread stage reserves it). Builds them in *buf and *cpu; NULL when
+// the stage keeps the shell's.
+static const sched_t *stage_sched(const pipeline_t *pl, int i, int *base, sched_t *buf,
+                                  cpu_set_t *cpu) {
+    const sched_t *own = pl->cmds[i].sched;
+
+    memset(buf, 0, sizeof(*buf));
+    if (pl->sched) *buf = *pl->sched;
+    if (own && (own->cpus || own->spread)) {
+        buf->cpus = own->cpus;
+        buf->spread = own->spread;
+    }
+    if (own && own->has_nice) {
+        buf->nice = own->nice;
+        buf->has_nice = 1;
+    }
+    if (own && own->ioprio) buf->ioprio = own->ioprio;
+
+    // A lone command is left to the scheduler; only pipelines are spread
+    if ((buf->spread || affinity_mode) && !buf->cpus && pl->num_cmds > 1) {
+        int c;
+        if (*base < 0) *base = sched_spread_base(pl->num_cmds);
+        c = sched_spread_cpu(*base + i);
+        if (c >= 0) {
+            CPU_ZERO(cpu);
+            CPU_SET(c, cpu);
+            buf->cpus = cpu;
+        }
+    }
+    return buf->cpus || buf->has_nice || buf->ioprio ? buf : NULL;
+}
+
+// Starts every stage of pl without waiting. std_fds, if not NULL, gives
+// the job's stdin, stdout and stderr; -1 entries keep the shell's own.
+// Returns 0 if the job was set up.
+int launch_pipeline(arena_t *a, pipeline_t *pl, const int *std_fds, job_t *job) {
+    int num_cmds = pl->num_cmds;
+    int nprocs = num_cmds;
+    int prev_in = -1;
+    int spread_base = -1;
+    int measure = pl->timed != TIME_NONE || trace_fd != -1;
+
+    job->plan = pl;
+    job->nalive = 0;
+    job->nstopped = 0;
+    job->term_sig = 0;
+    job->failed = -1;
+    job->torn_down = 0;
+    job->memo = NULL;
+    job->errtag = NULL;
+    job->cached = 0;
+    job->pgid = 0;
+    job->usage = NULL;
+    for (int i = 0; i < num_cmds; i++) {
+        if (pl->cmds[i].num_fanout || pl->memo) nprocs = 2 * num_cmds;
+    }
+    job->nprocs = nprocs;
+    job->pids = (pid_t *)arena_alloc(a, (size_t)nprocs * sizeof(pid_t));
+    job->stopped = (unsigned char *)arena_alloc(a, (size_t)nprocs);
+    job->statuses = (int *)arena_alloc(a, (size_t)num_cmds * sizeof(int));
+    if (measure) {
+        job->usage = (stage_usage_t *)arena_alloc(a, (size_t)num_cmds * sizeof(stage_usage_t));
+    }
+    if (!job->pids || !job->stopped || !job->statuses || (measure && !job->usage)) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return -1;
+    }
+    if (job->usage) memset(job->usage, 0, (size_t)num_cmds * sizeof(stage_usage_t));
+    for (int i = 0; i < nprocs; i++) {
+        job->pids[i] = -1;
+        job->stopped[i] = 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &job->started);
+
+    // A memo hit has already written the output; nothing gets started
+    if (pl->memo && memo_begin(a, pl, std_fds ? std_fds[1] : -1, job)) {
+        for (int i = 0; i < num_cmds; i++) job->statuses[i] = 0;
+        job->cached = 1;
+        clock_gettime(CLOCK_MONOTONIC, &job->finished);
+        trace_job(job);
+        return 0;
+    }
+
+    // Only the foreground wait drains the tagged pipes
+    if (stderr_tag && !std_fds && !pl->background) job->errtag = errtag_open(a, pl);
+
+    for (int i = 0; i < num_cmds; i++) {
+        command_t *cmd = &pl->cmds[i];
+        command_t fanned;
+        int pipefd[2] = {-1, -1};
+        int fan_fd = -1;
+        int tag_fd = -1;
+        stage_io_t io;
+        sched_t sched;
+        cpu_set_t cpu;
+        int base[3];
+        int opened[3] = { -1, -1, -1 };
+        const char *path;
+
+        job->statuses[i] = 127;
+
+        // Pipe for everything except last stage. Both ends are close-on-exec
+        // so no stage keeps a stray copy that would hold off EOF.
+        if (i < num_cmds - 1) {
+            if (make_pipe(pipefd) == -1) {
+                fprintf(stderr, "Error: pipe() failed. %s.\n", strerror(errno));
+                for (int k = i; k < num_cmds; k++) job->statuses[k] = 127;
+                if (job->failed < 0) job->failed = i;
+                break;
+            }
+        }
+
+        io.in_fd = i > 0 || !std_fds ? prev_in : std_fds[0];
+        io.out_fd = i < num_cmds - 1 ? pipefd[1] : std_fds ? std_fds[1] : -1;
+        io.err_fd = std_fds ? std_fds[2] : -1;
+        if (job->errtag && !find_redir(cmd, STDERR_FILENO)) {
+            tag_fd = errtag_pipe(job->errtag, i);
+            if (tag_fd != -1) io.err_fd = tag_fd;
+        }
+        io.close_fd = pipefd[0];
+        io.pgid = job_control ? job->pgid : -1;
+        io.sched = stage_sched(pl, i, &spread_base, &sched, &cpu);
+        cmd->fast = find_fast_stage(cmd->args[0]);
+        // The job keeps a copy: `hash -r` or a PATH change frees the
+        // cache entry while the stage may still be running
+        if (!cmd->fast && (path = path_cache_lookup(cmd->args[0]))) {
+            char *copy = (char *)arena_alloc(a, strlen(path) + 1);
+            cmd->path = copy ? strcpy(copy, path) : NULL;
+        }
+        cmd->split = xargs_split && !cmd->fast &&
+                     argv_bytes(cmd->args, cmd->num_args) > exec_arg_room();
+
+        // The helper goes first so it can lead the group; the stage then
+        // writes to it, and its > file is the helper's to fill
+        if (cmd->num_fanout) {
+            pid_t helper = start_fanout(cmd, &io, std_fds);
+            if (helper > 0) {
+                job->pids[num_cmds + i] = helper;
+                fan_fd = io.out_fd;
+                job->nalive++;
+                if (job_control && job->pgid == 0) job->pgid = helper;
+                io.pgid = job_control ? job->pgid : -1;
+            }
+            // The stage keeps every redirection but its > file
+            fanned = *cmd;
+            fanned.num_redirs = 0;
+            for (int k = 0; k < cmd->num_redirs; k++) {
+                const redir_t *r = &cmd->redirs[k];
+                if (r->fd != STDOUT_FILENO || !r->file) fanned.redirs[fanned.num_redirs++] = *r;
+            }
+            cmd = helper > 0 ? &fanned : NULL;
+            if (!cmd) job->statuses[i] = EXIT_FAILURE;
+        }
+        // memo's helper takes the same place for the last stage
+        if (i == num_cmds - 1 && job->memo) {
+            pid_t helper = memo_tee(job, &io);
+            if (helper > 0) {
+                job->pids[num_cmds + i] = helper;
+                fan_fd = io.out_fd;
+                job->nalive++;
+                if (job_control && job->pgid == 0) job->pgid = helper;
+                io.pgid = job_control ? job->pgid : -1;
+            }
+        }
+
+        // A target that cannot be opened fails the stage with status 1
+        base[0] = io.in_fd;
+        base[1] = io.out_fd;
+        base[2] = io.err_fd;
+        if (cmd && open_redirections(cmd, base, io.fds, opened) != 0) {
+            job->statuses[i] = EXIT_FAILURE;
+            cmd = NULL;
+        }
+
+        // A stage that fails to start leaves its reader with plain EOF
+        if (job->usage) {
+            clock_gettime(CLOCK_REALTIME, &job->usage[i].spawned);
+            clock_gettime(CLOCK_MONOTONIC, &job->usage[i].started);
+        }
+        job->pids[i] = cmd ? launch_stage(cmd, &io, &job->statuses[i]) : -1;
+        if (job->usage) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            job->usage[i].pid = job->pids[i];
+            job->usage[i].launch_ns = (now.tv_sec - job->usage[i].started.tv_sec) * 1000000000L +
+                                      (now.tv_nsec - job->usage[i].started.tv_nsec);
+        }
+        if (job->pids[i] <= 0 && job->failed < 0) job->failed = i;
+        if (job->pids[i] > 0) {
+            job->statuses[i] = 0;
+            job->nalive++;
+            if (job_control && job->pgid == 0) job->pgid = job->pids[i];
+        }
+
+        close_redirections(opened);
+        if (prev_in != -1) close(prev_in);
+        if (pipefd[1] != -1) close(pipefd[1]);
+        if (fan_fd != -1) close(fan_fd);
+        if (tag_fd != -1) close(tag_fd);
+        prev_in = pipefd[0];
+    }
+    if (prev_in != -1) close(prev_in);
+    if (job->nalive == 0) {
+        if (job->memo) memo_end(job);
+        trace_job(job);
+    }
+    return 0;
+}
@@ -0,0 +1,193 @@
+// The minishell program: a prompt loop over libminishell
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+
+#include "minishell.h"
+
+#define BRIGHTBLUE "\x1b[34;1m"
+#define DEFAULT "\x1b[0m"
+
+void print_prompt(void) {
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        fprintf(stderr, "Error: Cannot get current working directory. %s\n",
+                strerror(errno));
+        strcpy(cwd, "?");
+    }
+    printf("[%s%s%s]$ ", BRIGHTBLUE, cwd, DEFAULT);
+    fflush(stdout);
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: minishell [--trace log] [-j jobs [-k]] [-c command | script]\n"
+                    "       minishell [--trace log] --serve socket\n"
+                    "       minishell --connect socket [-c command | script]\n");
+    exit(2);
+}
+
+// --connect: sends each line to a --serve shell, with our stdin, stdout
+// and stderr, and exits with the last status it reports
+static int run_remote(const char *path, ms_reader_t *reader) {
+    static const int std_fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    int sock = ms_connect(path);
+    int status = 0;
+    char *line;
+    int rc;
+
+    if (sock == -1) {
+        fprintf(stderr, "Error: Cannot connect to '%s'. %s.\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    while ((rc = ms_read_line(reader, &line)) > 0) {
+        if (line[0] == '\0') continue;
+        // The protocol is one request per line
+        if (strchr(line, '\n')) {
+            fprintf(stderr, "Error: Here-documents cannot be sent to a --serve shell.\n");
+            status = 2;
+            continue;
+        }
+        status = ms_remote_run(sock, line, std_fds);
+        if (status < 0) {
+            fprintf(stderr, "Error: Lost connection to '%s'.\n", path);
+            status = EXIT_FAILURE;
+            break;
+        }
+    }
+    close(sock);
+    return status;
+}
+
+// Main
+int main(int argc, char **argv) {
+    ms_reader_t *reader;
+    char *command_string = NULL;
+    int njobs = 0;
+    int keep_order = 0;
+    int interactive = 0;
+    const char *serve_path = NULL;
+    const char *connect_path = NULL;
+    const char *trace_path = getenv("MINISHELL_TRACE");
+    int opt;
+    static const struct option long_opts[] = {
+        { "serve",   required_argument, NULL, 'S' },
+        { "connect", required_argument, NULL, 'C' },
+        { "trace",   required_argument, NULL, 'T' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    while ((opt = getopt_long(argc, argv, "+c:j:k", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'S':
+            serve_path = optarg;
+            break;
+        case 'C':
+            connect_path = optarg;
+            break;
+        case 'T':
+            trace_path = optarg;
+            break;
+        case 'c':
+            command_string = optarg;
+            break;
+        case 'j':
+            njobs = atoi(optarg);
+            if (njobs < 1) {
+                fprintf(stderr, "Error: -j needs a positive job count.\n");
+                exit(2);
+            }
+            break;
+        case 'k':
+            keep_order = 1;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (keep_order && !njobs) usage();
+    if ((serve_path || connect_path) && njobs) usage();
+
+    // Runs on the server, not in a --connect client
+    if (trace_path && *trace_path && !connect_path && ms_trace(trace_path) != 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    if (serve_path) {
+        if (connect_path || command_string || optind != argc) usage();
+        if (ms_init(0) != 0) exit(EXIT_FAILURE);
+        exit(ms_serve(serve_path));
+    }
+
+    if (command_string) {
+        if (optind != argc) usage();
+        reader = ms_reader_string(command_string);
+    } else if (optind == argc - 1) {
+        int fd = open(argv[optind], O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            fprintf(stderr, "Error: Cannot open script '%s'. %s.\n",
+                    argv[optind], strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        reader = ms_reader_fd(fd);
+    } else if (optind != argc) {
+        usage();
+    } else {
+        // Prompts are only drawn for a person at a terminal
+        interactive = isatty(STDIN_FILENO);
+        reader = ms_reader_fd(STDIN_FILENO);
+    }
+    if (!reader) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (connect_path) {
+        exit(run_remote(connect_path, reader));
+    }
+
+    if (ms_init(interactive ? MS_INTERACTIVE : 0) != 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    // Initial launch backend, e.g. MINISHELL_LAUNCH=fork
+    const char *launch = getenv("MINISHELL_LAUNCH");
+    if (launch && *launch) {
+        char spec[64];
+        snprintf(spec, sizeof(spec), "launch=%s", launch);
+        ms_set_option(spec);
+    }
+
+    if (njobs > 0) {
+        exit(ms_run_batch(reader, njobs, keep_order));
+    }
+
+    while (1) {
+        if (ms_interrupted()) continue;
+
+        ms_notify_jobs();
+        if (interactive) print_prompt();
+
+        char *command;
+        int rc = ms_read_line(reader, &command);
+        if (rc <= 0) {
+            if (rc < 0 && errno == EINTR && ms_interrupted()) continue;
+            if (rc == 0) {
+                if (interactive) putchar('\n');
+                exit(ms_status());
+            }
+            fprintf(stderr, "Error: Failed to read input. %s.\n",
+                    strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        if (command[0] == '\0') continue;
+        ms_run_line(command);
+    }
+}
@@ -0,0 +1,255 @@
+// Output cache behind the `memo` pipeline prefix
+
+#include "shell.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define MEMO_HASH_INIT 14695981039346656037ULL
+
+extern char **environ;
+
+// FNV-1a over len bytes, 64 bits wide since the hash names cache files
+static unsigned long long hash_bytes(unsigned long long h, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static unsigned long long hash_str(unsigned long long h, const char *s) {
+    // The NUL keeps ("ab", "c") apart from ("a", "bc")
+    return hash_bytes(h, s, strlen(s) + 1);
+}
+
+// Mixes in the identity and version of a file: device, inode, size and
+// mtime. A missing file hashes as such, so creating it changes the key.
+static unsigned long long hash_file(unsigned long long h, const char *path) {
+    struct stat st;
+    long long id[5] = { 0, 0, -1, 0, 0 };
+
+    if (stat(path, &st) == 0) {
+        id[0] = (long long)st.st_dev;
+        id[1] = (long long)st.st_ino;
+        id[2] = (long long)st.st_size;
+        id[3] = (long long)st.st_mtim.tv_sec;
+        id[4] = (long long)st.st_mtim.tv_nsec;
+    }
+    h = hash_str(h, path);
+    return hash_bytes(h, id, sizeof(id));
+}
+
+// Key for a pipeline's output: the working directory, the environment,
+// and per stage its argv, the executable it resolves to and its < file
+// or here-document
+static unsigned long long memo_key(const pipeline_t *pl) {
+    unsigned long long h = MEMO_HASH_INIT;
+    char cwd[PATH_MAX];
+
+    h = hash_str(h, getcwd(cwd, sizeof(cwd)) ? cwd : "");
+    for (char **e = environ; *e; e++) h = hash_str(h, *e);
+    for (int i = 0; i < pl->num_cmds; i++) {
+        const command_t *cmd = &pl->cmds[i];
+        const char *exe = strchr(cmd->args[0], '/') ? cmd->args[0]
+                                                    : path_cache_lookup(cmd->args[0]);
+
+        h = hash_str(h, "|");
+        for (int j = 0; j < cmd->num_args; j++) h = hash_str(h, cmd->args[j]);
+        if (exe) h = hash_file(h, exe);
+        for (int j = 0; j < cmd->num_redirs; j++) {
+            const redir_t *r = &cmd->redirs[j];
+            if (r->fd != STDIN_FILENO) continue;
+            if (r->file) h = hash_file(h, r->file);
+            if (r->here) h = hash_str(hash_str(h, "<<"), r->here);
+        }
+    }
+    return h;
+}
+
+// Creates dir and any missing parents
+static int make_dirs(char *dir) {
+    for (char *p = dir + 1; ; p++) {
+        if (*p != '/' && *p != '\0') continue;
+        char saved = *p;
+        *p = '\0';
+        if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+            *p = saved;
+            return -1;
+        }
+        *p = saved;
+        if (saved == '\0') return 0;
+    }
+}
+
+// Cache directory: $MINISHELL_MEMO_DIR, else minishell/memo under
+// $XDG_CACHE_HOME or ~/.cache. Returns NULL if there is none.
+static const char *memo_dir(void) {
+    static char dir[PATH_MAX];
+    const char *env = getenv("MINISHELL_MEMO_DIR");
+    int n;
+
+    if (env && *env) {
+        n = snprintf(dir, sizeof(dir), "%s", env);
+    } else if ((env = getenv("XDG_CACHE_HOME")) && *env) {
+        n = snprintf(dir, sizeof(dir), "%s/minishell/memo", env);
+    } else if ((env = getenv("HOME")) && *env) {
+        n = snprintf(dir, sizeof(dir), "%s/.cache/minishell/memo", env);
+    } else {
+        errno = ENOENT;
+        return NULL;
+    }
+    if (n < 0 || (size_t)n >= sizeof(dir)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    return make_dirs(dir) == 0 ? dir : NULL;
+}
+
+// Copies a whole file to out_fd (-1 for stdout) from its start
+static int memo_replay(int fd, int out_fd) {
+    if (lseek(fd, 0, SEEK_SET) == -1) return -1;
+    return copy_fd(fd, out_fd != -1 ? out_fd : STDOUT_FILENO);
+}
+
+// Called before a `memo` pipeline is launched. On a hit the cached
+// output is written to out_fd (-1 for stdout) and 1 is returned. On a
+// miss job->memo is set up with an unnamed file in the cache directory
+// for memo_tee to fill, and 0 is returned; the pipeline also just runs
+// uncached when its output is redirected or goes to >(...) consumers, or
+// when the cache is unusable.
+int memo_begin(arena_t *a, const pipeline_t *pl, int out_fd, job_t *job) {
+    const char *dir;
+    memo_capture_t *m;
+    int fd;
+
+    job->memo = NULL;
+    if (find_redir(&pl->cmds[pl->num_cmds - 1], STDOUT_FILENO)) return 0;
+    for (int i = 0; i < pl->num_cmds; i++) {
+        if (pl->cmds[i].num_fanout) return 0;
+    }
+    if (!(dir = memo_dir())) {
+        fprintf(stderr, "Error: memo: No cache directory. %s.\n", strerror(errno));
+        return 0;
+    }
+
+    m = (memo_capture_t *)arena_alloc(a, sizeof(*m));
+    if (!m || !(m->path = (char *)arena_alloc(a, strlen(dir) + 18))) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return 0;
+    }
+    sprintf(m->path, "%s/%016llx", dir, memo_key(pl));
+    m->out_fd = out_fd;
+    m->pid = -1;
+    m->complete = 0;
+
+    fd = open(m->path, O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+        int rc = memo_replay(fd, out_fd);
+        close(fd);
+        if (rc == 0) return 1;
+        fprintf(stderr, "Error: memo: Cannot replay '%s'. %s.\n", m->path, strerror(errno));
+        return 0;
+    }
+
+    // The capture only gets a name once the pipeline has succeeded
+    m->fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (m->fd == -1) {
+        fprintf(stderr, "Error: memo: Cannot create a file in '%s'. %s.\n", dir, strerror(errno));
+        return 0;
+    }
+    job->memo = m;
+    return 0;
+}
+
+// Helper side of memo_tee: passes what the last stage writes to src on
+// to where it belongs and into the capture. Exits 1 if the capture is
+// incomplete, so it is not stored; losing the reader ends the helper
+// with SIGPIPE, and the stage with it.
+static void memo_pump(int src, const memo_capture_t *m, const stage_io_t *io) {
+    char buf[READ_CHUNK_SIZE];
+    int out = m->out_fd != -1 ? m->out_fd : STDOUT_FILENO;
+    int complete = 1;
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    if (io->pgid >= 0) {
+        setpgid(0, io->pgid);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+    }
+    // The stage's ends of its pipes; holding them would keep EOF away
+    if (io->in_fd > STDERR_FILENO) close(io->in_fd);
+    close(io->out_fd);
+    if (io->err_fd != -1) dup2(io->err_fd, STDERR_FILENO);
+
+    for (;;) {
+        ssize_t n = read(src, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n < 0) complete = 0;
+            break;
+        }
+        if (write_all(out, buf, (size_t)n) != 0) _exit(1);
+        if (complete && write_all(m->fd, buf, (size_t)n) != 0) {
+            fprintf(stderr, "Error: memo: Cannot write the capture. %s.\n", strerror(errno));
+            complete = 0;
+        }
+    }
+    _exit(complete ? 0 : 1);
+}
+
+// Points the last stage of a miss at a pipe whose helper hands the
+// output on as it arrives while capturing it, so a memo pipeline streams
+// like any other. Returns the helper's pid, or -1 after reporting a
+// failure, with the capture dropped so the pipeline runs uncached.
+pid_t memo_tee(job_t *job, stage_io_t *io) {
+    memo_capture_t *m = job->memo;
+    int fds[2];
+    pid_t pid = -1;
+
+    if (pipe2(fds, O_CLOEXEC) == 0) {
+        io->out_fd = fds[1];
+        // Nothing buffered may be written twice
+        fflush(NULL);
+        pid = fork();
+        if (pid == 0) memo_pump(fds[0], m, io);
+        close(fds[0]);
+        if (pid < 0) {
+            close(fds[1]);
+            io->out_fd = m->out_fd;
+        }
+    }
+    if (pid < 0) {
+        fprintf(stderr, "Error: memo: Cannot start the capture. %s.\n", strerror(errno));
+        close(m->fd);
+        job->memo = NULL;
+        return -1;
+    }
+    // Set the group from both sides so neither races the other
+    if (io->pgid >= 0) setpgid(pid, io->pgid ? io->pgid : pid);
+    m->pid = pid;
+    return pid;
+}
+
+// Called once every stage of a memo job and its helper have exited:
+// links the capture into the cache if the pipeline succeeded
+void memo_end(job_t *job) {
+    memo_capture_t *m = job->memo;
+    int n = job->plan->num_cmds;
+
+    job->memo = NULL;
+    if (m->complete && job->failed < 0 && job->statuses[n - 1] == 0) {
+        char proc[64];
+        snprintf(proc, sizeof(proc), "/proc/self/fd/%d", m->fd);
+        // EEXIST means a concurrent run already stored the same key
+        if (linkat(AT_FDCWD, proc, AT_FDCWD, m->path, AT_SYMLINK_FOLLOW) != 0 &&
+            errno != EEXIST) {
+            fprintf(stderr, "Error: memo: Cannot store '%s'. %s.\n", m->path, strerror(errno));
+        }
+    }
+    close(m->fd);
+}
@@ -0,0 +1,89 @@
+// Public interface to the shell core, as built into libminishell.a.
+//
+// A host parses a command line into a plan and runs it, getting back the
+// exit status of the last stage; the minishell binary is just a prompt
+// loop over these calls. The library keeps process-wide state (the job
+// table, the command path cache and `set` options), so use it from one
+// thread at a time.
+
+#ifndef MINISHELL_H
+#define MINISHELL_H
+
+// Flags for ms_init
+#define MS_INTERACTIVE 0x1     // Take the terminal and enable job control
+
+typedef struct ms_plan ms_plan_t;
+typedef struct ms_reader ms_reader_t;
+
+// Installs the SIGINT/SIGCHLD handlers; call once before running anything.
+// Returns 0, or -1 after reporting why on stderr.
+int ms_init(int flags);
+
+// Parses one line: pipelines joined by ;, &, && and ||, with ( ) for
+// grouping. Syntax errors are reported on stderr and give NULL. A blank
+// line parses to a plan with no commands.
+ms_plan_t *ms_parse(const char *line);
+
+// Number of pipeline stages in a plan, over all of its pipelines
+int ms_plan_stages(const ms_plan_t *plan);
+
+// Runs a plan and releases it; returns the exit status of the last
+// pipeline it ran (128 + signal number if it was killed). Background
+// pipelines count as 0 right away and finish on their own.
+int ms_run(ms_plan_t *plan);
+
+// Releases a plan that was never run
+void ms_plan_free(ms_plan_t *plan);
+
+// Parses and runs a line in one go, reusing a per-shell arena
+int ms_run_line(const char *line);
+
+// Status of the most recent foreground command
+int ms_status(void);
+
+// Applies a `set -o` option from "name=value" or a bare "name" to turn an
+// on/off option on. Returns 0, or -1 for a bad name or value.
+int ms_set_option(const char *spec);
+
+// Appends a JSON line per pipeline stage to the log at path as each
+// pipeline finishes: argv, pid, launch time and latency, status, wall and
+// CPU time, and redirections. Returns 0, or -1 after reporting why.
+int ms_trace(const char *path);
+
+// Reaps finished children and reports background jobs that are done
+void ms_notify_jobs(void);
+
+// True once after each SIGINT the shell received
+int ms_interrupted(void);
+
+// Line sources: a file descriptor, or a string that is consumed in place
+ms_reader_t *ms_reader_fd(int fd);
+ms_reader_t *ms_reader_string(char *text);
+
+// Reads the next line without its newline; a line that opens <<
+// here-documents comes with their bodies, joined by newlines. Returns 1
+// with *line set (valid until the next call), 0 at end of input, -1 on
+// error.
+int ms_read_line(ms_reader_t *r, char **line);
+
+// Closes the descriptor, if any, and frees the reader
+void ms_reader_close(ms_reader_t *r);
+
+// Runs every line from r as an independent pipeline, up to njobs at a
+// time; keep_order prints each job's output in input order. Returns an
+// exit status for the whole batch.
+int ms_run_batch(ms_reader_t *r, int njobs, int keep_order);
+
+// Serves command lines on a Unix socket at path until SIGINT. Each
+// request is "line\n" with the client's stdin, stdout and stderr passed
+// as SCM_RIGHTS; the reply is "status N\n". Returns an exit status.
+int ms_serve(const char *path);
+
+// Client side: connects to a server, returning the socket or -1
+int ms_connect(const char *path);
+
+// Runs line on the server with std_fds (stdin, stdout, stderr; NULL for
+// /dev/null) and returns its exit status, or -1 if the exchange failed
+int ms_remote_run(int sock, const char *line, const int std_fds[3]);
+
+#endif
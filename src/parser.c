@@ -0,0 +1,845 @@
+// Lexer and parser: one input line to a plan of pipelines
+
+#include "shell.h"
+
+#include <ctype.h>
+
+static int is_empty(const char *s) {
+    if (!s) return 1;
+    for (; *s; ++s) {
+        if (!isspace((unsigned char)*s)) return 0;
+    }
+    return 1;
+}
+
+// Appends a token; the array grows inside the arena
+static int push_token(arena_t *a, token_list_t *tl, token_type_t type, char *text,
+                      size_t start, size_t end) {
+    if (tl->count == tl->cap) {
+        int cap = tl->cap ? tl->cap * 2 : 16;
+        token_t *grown = (token_t *)arena_alloc(a, (size_t)cap * sizeof(*grown));
+        if (!grown) {
+            fprintf(stderr, "Error: Out of memory while tokenizing.\n");
+            return -1;
+        }
+        if (tl->count > 0) memcpy(grown, tl->toks, (size_t)tl->count * sizeof(*grown));
+        tl->toks = grown;
+        tl->cap = cap;
+    }
+    tl->toks[tl->count].type = type;
+    tl->toks[tl->count].text = text;
+    tl->toks[tl->count].expand = 0;
+    tl->toks[tl->count].quoted = 0;
+    tl->toks[tl->count].start = (int)start;
+    tl->toks[tl->count].end = (int)end;
+    tl->count++;
+    return 0;
+}
+
+// Copies the $ reference or $(...) / `...` substitution at s into word,
+// in the marked form expand_pipeline reads; dquote is set inside double
+// quotes. Returns the input bytes used, 0 if s starts neither, or -1
+// after reporting an unclosed substitution.
+static long lex_expansion(const char *s, int dquote, char *word, size_t *wlen) {
+    if (s[0] == '`' || (s[0] == '$' && s[1] == '(')) {
+        const char *body = s + 1;
+        const char *end = s[0] == '$' ? body + subst_length(body) : strchr(body, '`');
+        size_t n;
+
+        if (!end || (s[0] == '$' && end == body)) {
+            fprintf(stderr, "Error: Missing closing '%s'.\n", s[0] == '$' ? ")" : "`");
+            return -1;
+        }
+        n = (size_t)(end - body);
+        word[(*wlen)++] = PARAM_MARK;
+        if (dquote) word[(*wlen)++] = '"';
+        if (s[0] == '`') word[(*wlen)++] = '(';
+        memcpy(word + *wlen, body, n);
+        *wlen += n;
+        if (s[0] == '`') {
+            word[(*wlen)++] = ')';
+            n++;
+        }
+        return (long)n + 1;
+    }
+    if (s[0] == '$') {
+        size_t n = param_length(s);
+        int bare = n > 1 && var_name_length(s + 1) == n - 1;
+        if (n == 0) return 0;
+        word[(*wlen)++] = PARAM_MARK;
+        if (dquote) word[(*wlen)++] = '"';
+        // $NAME is kept as {NAME}, so that quoted text right after it, as
+        // in $A'b', cannot run on into the name once the quotes are gone
+        if (bare) word[(*wlen)++] = '{';
+        memcpy(word + *wlen, s + 1, n - 1);
+        *wlen += n - 1;
+        if (bare) word[(*wlen)++] = '}';
+        return (long)n;
+    }
+    return 0;
+}
+
+// Reads the bodies of the here-documents from tl->toks[*next] on, one
+// after the other, out of the lines at input[pos]: each body runs up to
+// a line that is just its delimiter. Bodies keep their newlines and,
+// unless the delimiter was quoted, their $ references in marked form.
+// Returns the position after the last delimiter line, or -1 on error.
+static long lex_heredocs(arena_t *a, const char *input, size_t pos, token_list_t *tl,
+                         int *next) {
+    for (; *next < tl->count; (*next)++) {
+        token_t *t = &tl->toks[*next];
+        const token_t *delim = t + 1;
+        size_t dlen, blen = 0;
+        char *body;
+
+        // A missing delimiter is reported by the parser
+        if (t->type != TOK_HEREDOC || *next + 1 >= tl->count || delim->type != TOK_WORD) {
+            continue;
+        }
+        dlen = strlen(delim->text);
+        // Marks add at most three bytes per $ and one per backquote
+        body = (char *)arena_alloc(a, 3 * strlen(input + pos) + 1);
+        if (!body) {
+            fprintf(stderr, "Error: Out of memory while tokenizing.\n");
+            return -1;
+        }
+
+        for (;;) {
+            const char *line = input + pos;
+            const char *nl = strchr(line, '\n');
+            size_t llen = nl ? (size_t)(nl - line) : strlen(line);
+
+            if (llen == dlen && strncmp(line, delim->text, dlen) == 0) {
+                pos += llen + (nl != NULL);
+                break;
+            }
+            if (!nl) {
+                fprintf(stderr, "Error: Missing '%s' to end the here-document.\n", delim->text);
+                return -1;
+            }
+            for (size_t k = 0; k < llen; ) {
+                long n = 0;
+                if (!delim->quoted && (line[k] == '$' || line[k] == '`')) {
+                    size_t saved = blen;
+                    n = lex_expansion(line + k, 1, body, &blen);
+                    if (n < 0) return -1;
+                    // Substitutions do not run across lines here
+                    if ((size_t)n > llen - k) {
+                        blen = saved;
+                        n = 0;
+                    }
+                    if (n > 0) t->expand = 1;
+                }
+                if (n == 0) {
+                    body[blen++] = line[k];
+                    n = 1;
+                }
+                k += (size_t)n;
+            }
+            body[blen++] = '\n';
+            pos += llen + 1;
+        }
+        body[blen] = '\0';
+        t->text = body;
+    }
+    return (long)pos;
+}
+
+// Lexer: splits a line into words and operators in one quote-aware pass.
+// Quotes are removed and adjacent quoted/unquoted pieces join one word.
+// Word bytes are packed back to back into one arena buffer: a word is never
+// longer than the input it came from and words are separated by at least
+// one input byte, so len + 1 bytes suffice, plus one GLOB_MARK for each
+// unquoted *, ? or [. A $ reference keeps its text, braced, behind a
+// PARAM_MARK and a '"' if it was in double quotes; a $(...) or `...`
+// substitution is PARAM_MARK, the same '"', then (command): at most three
+// bytes more per $ and one per backquote. All of them are expanded when
+// the pipeline runs. A newline ends the line's commands; the lines after
+// it hold the bodies of its << here-documents.
+int lex_line(arena_t *a, const char *input, token_list_t *tl) {
+    size_t len = strlen(input);
+    size_t marks = 0;
+    char *store;
+    char *word;
+    size_t wlen = 0;
+    size_t wstart = 0;
+    int in_word = 0;
+    int expand = 0;
+    int quoted = 0;
+    int heredoc_next = 0;
+    char quote = 0;
+    size_t i;
+
+    tl->toks = NULL;
+    tl->count = 0;
+    tl->cap = 0;
+
+    for (const char *g = input; (g = strpbrk(g, "*?[$`")) != NULL; g++) {
+        marks += *g == '$' ? 3 : 1;
+    }
+    store = (char *)arena_alloc(a, len + marks + 1);
+    if (!store) {
+        fprintf(stderr, "Error: Out of memory while tokenizing.\n");
+        return -1;
+    }
+    word = store;
+
+    #define FLUSH_WORD() do { \
+        if (in_word) { \
+            word[wlen] = '\0'; \
+            if (push_token(a, tl, TOK_WORD, word, wstart, i) != 0) return -1; \
+            tl->toks[tl->count - 1].expand = expand; \
+            tl->toks[tl->count - 1].quoted = quoted; \
+            word += wlen + 1; \
+            wlen = 0; \
+            in_word = 0; \
+            expand = 0; \
+            quoted = 0; \
+        } \
+    } while (0)
+
+    #define PUSH_OP(type, n) do { \
+        if (push_token(a, tl, type, NULL, i, i + (n)) != 0) return -1; \
+        i += (n) - 1; \
+    } while (0)
+
+    for (i = 0; i < len; i++) {
+        char c = input[i];
+
+        if (!in_word) wstart = i;
+
+        // Parameters and substitutions expand outside single quotes
+        if ((c == '$' || c == '`') && quote != '\'') {
+            long n = lex_expansion(input + i, quote == '"', word, &wlen);
+            if (n < 0) return -1;
+            if (n > 0) {
+                i += (size_t)n - 1;
+                in_word = 1;
+                expand = 1;
+                continue;
+            }
+        }
+
+        if (quote) {
+            if (c == quote) quote = 0;
+            else word[wlen++] = c;
+            continue;
+        }
+
+        if (c == '"' || c == '\'') {
+            quote = c;
+            in_word = 1;
+            quoted = 1;
+        } else if (c == '\n') {
+            long pos;
+            FLUSH_WORD();
+            if ((pos = lex_heredocs(a, input, i + 1, tl, &heredoc_next)) < 0) return -1;
+            i = (size_t)pos - 1;
+        } else if (isspace((unsigned char)c)) {
+            FLUSH_WORD();
+        } else if (c == '|') {
+            FLUSH_WORD();
+            if (input[i + 1] == '|') PUSH_OP(TOK_OR_IF, 2);
+            else if (input[i + 1] == '&') PUSH_OP(TOK_PIPE_ERR, 2);
+            else PUSH_OP(TOK_PIPE, 1);
+        } else if (c == '&') {
+            FLUSH_WORD();
+            if (input[i + 1] == '&') PUSH_OP(TOK_AND_IF, 2);
+            else PUSH_OP(TOK_AMP, 1);
+        } else if (c == ';') {
+            FLUSH_WORD();
+            PUSH_OP(TOK_SEMI, 1);
+        } else if (c == '(' || c == ')') {
+            FLUSH_WORD();
+            PUSH_OP(c == '(' ? TOK_LPAREN : TOK_RPAREN, 1);
+        } else if (c == '<') {
+            FLUSH_WORD();
+            if (input[i + 1] == '<' && input[i + 2] == '<') PUSH_OP(TOK_HERESTR, 3);
+            else if (input[i + 1] == '<') PUSH_OP(TOK_HEREDOC, 2);
+            else PUSH_OP(TOK_IN, 1);
+        } else if (c == '>' && input[i + 1] == '(') {
+            // >(...) keeps its command line as written; it is parsed
+            // again by the process that runs it
+            size_t n = subst_length(input + i + 1);
+            char *text;
+            FLUSH_WORD();
+            if (n == 0) {
+                fprintf(stderr, "Error: Missing closing ')'.\n");
+                return -1;
+            }
+            if (!(text = (char *)arena_alloc(a, n - 1))) {
+                fprintf(stderr, "Error: Out of memory while tokenizing.\n");
+                return -1;
+            }
+            memcpy(text, input + i + 2, n - 2);
+            text[n - 2] = '\0';
+            if (push_token(a, tl, TOK_FANOUT, text, i, i + n + 1) != 0) return -1;
+            i += n;
+        } else if (c == '>') {
+            // A bare digit right before it names the fd: 1> is >, 2> stderr
+            int fd = in_word && wlen == 1 && isdigit((unsigned char)word[0]) && !quoted && !expand
+                     ? word[0] - '0' : -1;
+            size_t from = fd >= 0 ? wstart : i;
+            int to = -1;
+            if (fd >= 0) {
+                wlen = 0;
+                in_word = 0;
+            }
+            FLUSH_WORD();
+            if (input[i + 1] == '&' && isdigit((unsigned char)input[i + 2]) &&
+                !isdigit((unsigned char)input[i + 3])) {
+                to = input[i + 2] - '0';
+            }
+            if (fd == -1) fd = STDOUT_FILENO;
+            // Only stdout and stderr can be redirected, and duplicated
+            // onto each other: N>&N leaves things as they are
+            if (fd == 0 || fd > 2 || (input[i + 1] == '&' && (to < 1 || to > 2))) {
+                size_t n = i + 1 - from + (input[i + 1] == '&') + (to >= 0);
+                fprintf(stderr, "Error: Unsupported redirection '%.*s'.\n", (int)n, input + from);
+                return -1;
+            }
+            if (to == fd) i += 2;
+            else if (to >= 0) PUSH_OP(fd == 2 ? TOK_ERR_DUP : TOK_OUT_DUP, 3);
+            else if (input[i + 1] == '>') PUSH_OP(fd == 2 ? TOK_ERR_APPEND : TOK_APPEND, 2);
+            else PUSH_OP(fd == 2 ? TOK_ERR_OUT : TOK_OUT, 1);
+        } else {
+            // Unquoted wildcards are marked so quoting keeps them literal
+            if (c == '*' || c == '?' || c == '[') {
+                word[wlen++] = GLOB_MARK;
+                expand = 1;
+            }
+            word[wlen++] = c;
+            in_word = 1;
+        }
+    }
+
+    if (quote) {
+        fprintf(stderr, "Error: Missing closing quote.\n");
+        return -1;
+    }
+    FLUSH_WORD();
+    if (lex_heredocs(a, input, len, tl, &heredoc_next) < 0) return -1;
+
+    #undef FLUSH_WORD
+    #undef PUSH_OP
+
+    return 0;
+}
+
+// Delimiters of the << here-documents on line, in order and with quotes
+// removed, as malloc'd strings in *delims. The reader uses them to tell
+// how many of the following lines belong to the command. Returns how
+// many there are, or -1 when out of memory.
+int heredoc_delimiters(const char *line, char ***delims) {
+    int count = 0, cap = 0;
+    char quote = 0;
+
+    *delims = NULL;
+    for (const char *p = line; *p; p++) {
+        char *d, *o;
+        char q = 0;
+
+        if (quote) {
+            if (*p == quote) quote = 0;
+            continue;
+        }
+        if (*p == '\'' || *p == '"') {
+            quote = *p;
+            continue;
+        }
+        if (p[0] != '<' || p[1] != '<') continue;
+        if (p[2] == '<') {
+            p += 2;
+            continue;
+        }
+        for (p += 2; *p == ' ' || *p == '\t'; p++) {}
+
+        if (!(d = o = (char *)malloc(strlen(p) + 1))) goto oom;
+        for (; *p && (q || !(isspace((unsigned char)*p) || strchr("|&;()<>", *p))); p++) {
+            if (q ? *p == q : *p == '\'' || *p == '"') q = q ? 0 : *p;
+            else *o++ = *p;
+        }
+        *o = '\0';
+        p--;
+        if (o == d) {
+            free(d);
+            continue;
+        }
+        if (count == cap) {
+            char **grown;
+            cap = cap ? cap * 2 : 4;
+            if (!(grown = (char **)realloc(*delims, (size_t)cap * sizeof(char *)))) {
+                free(d);
+                goto oom;
+            }
+            *delims = grown;
+        }
+        (*delims)[count++] = d;
+    }
+    return count;
+
+oom:
+    while (count > 0) free((*delims)[--count]);
+    free(*delims);
+    *delims = NULL;
+    return -1;
+}
+
+static const char *token_name(token_type_t type) {
+    switch (type) {
+    case TOK_IN:     return "<";
+    case TOK_OUT:    return ">";
+    case TOK_APPEND: return ">>";
+    case TOK_ERR_OUT: return "2>";
+    case TOK_ERR_APPEND: return "2>>";
+    case TOK_ERR_DUP: return "2>&1";
+    case TOK_OUT_DUP: return ">&2";
+    case TOK_PIPE_ERR: return "|&";
+    case TOK_FANOUT: return ">(";
+    case TOK_HEREDOC: return "<<";
+    case TOK_HERESTR: return "<<<";
+    case TOK_AMP:    return "&";
+    case TOK_SEMI:   return ";";
+    case TOK_AND_IF: return "&&";
+    case TOK_OR_IF:  return "||";
+    case TOK_LPAREN: return "(";
+    case TOK_RPAREN: return ")";
+    default:         return "|";
+    }
+}
+
+// Appends a redirection of fd to cmd, to be filled in
+static redir_t *add_redir(command_t *cmd, int fd) {
+    redir_t *r = &cmd->redirs[cmd->num_redirs++];
+
+    r->fd = fd;
+    r->file = NULL;
+    r->here = NULL;
+    r->append = 0;
+    r->dup = -1;
+    return r;
+}
+
+// Parses argv and redirections for the stage in toks[start, end)
+static int parse_command(arena_t *a, const token_list_t *tl, int start, int end,
+                         command_t *cmd) {
+    int nwords = 0;
+    int nfanout = 0;
+    int j;
+
+    cmd->quoted = NULL;
+    cmd->num_redirs = 0;
+    cmd->fanout = NULL;
+    cmd->num_fanout = 0;
+    cmd->num_args = 0;
+    cmd->path = NULL;
+    cmd->fast = NULL;
+    cmd->expand = 0;
+    cmd->split = 0;
+    cmd->sched = NULL;
+
+    // Catch commands that start with a redirection operator
+    if (tl->toks[start].type != TOK_WORD) {
+        fprintf(stderr, "Error: Invalid Command.\n");
+        return -1;
+    }
+
+    for (j = start; j < end; j++) {
+        if (tl->toks[j].type == TOK_WORD) nwords++;
+        if (tl->toks[j].type == TOK_FANOUT) nfanout++;
+        cmd->expand |= tl->toks[j].expand;
+    }
+    cmd->args = (char **)arena_alloc(a, ((size_t)nwords + 1) * sizeof(char *));
+    if (nfanout) cmd->fanout = (char **)arena_alloc(a, (size_t)nfanout * sizeof(char *));
+    if (cmd->expand) cmd->quoted = (unsigned char *)arena_alloc(a, (size_t)nwords + 1);
+    if (!cmd->args || (nfanout && !cmd->fanout) || (cmd->expand && !cmd->quoted)) {
+        fprintf(stderr, "Error: Out of memory while parsing.\n");
+        return -1;
+    }
+
+    for (j = start; j < end; j++) {
+        token_type_t type = tl->toks[j].type;
+        const char *op;
+        int fd;
+        redir_t *r;
+
+        if (type == TOK_WORD) {
+            if (cmd->quoted) cmd->quoted[cmd->num_args] = (unsigned char)tl->toks[j].quoted;
+            cmd->args[cmd->num_args++] = tl->toks[j].text;
+            continue;
+        }
+        if (type == TOK_FANOUT) {
+            if (is_empty(tl->toks[j].text)) {
+                fprintf(stderr, "Error: Empty Command.\n");
+                return -1;
+            }
+            cmd->fanout[cmd->num_fanout++] = tl->toks[j].text;
+            continue;
+        }
+
+        op = token_name(type);
+        fd = type == TOK_IN || type == TOK_HEREDOC || type == TOK_HERESTR ? STDIN_FILENO :
+             type == TOK_ERR_OUT || type == TOK_ERR_APPEND || type == TOK_ERR_DUP ? STDERR_FILENO :
+             STDOUT_FILENO;
+        if (find_redir(cmd, fd)) {
+            fprintf(stderr, "Error: Multiple %s redirections not allowed.\n",
+                    fd == STDIN_FILENO ? "input" : fd == STDERR_FILENO ? "error" : "output");
+            return -1;
+        }
+        // Duplications take effect in order with the rest: 2>&1 >file
+        // leaves stderr where stdout was before the file
+        if (type == TOK_ERR_DUP || type == TOK_OUT_DUP) {
+            add_redir(cmd, fd)->dup = fd == STDERR_FILENO ? STDOUT_FILENO : STDERR_FILENO;
+            continue;
+        }
+        if (j + 1 >= end || tl->toks[j + 1].type != TOK_WORD) {
+            fprintf(stderr, "Error: Missing %s after '%s'.\n",
+                    type == TOK_HEREDOC ? "delimiter" : type == TOK_HERESTR ? "word" : "filename",
+                    op);
+            return -1;
+        }
+        if (type == TOK_HEREDOC) {
+            add_redir(cmd, fd)->here = tl->toks[j].text;
+        } else if (type == TOK_HERESTR) {
+            // The word plus a newline; wildcards stay as written
+            const char *w = tl->toks[j + 1].text;
+            char *o = (char *)arena_alloc(a, strlen(w) + 2);
+            if (!o) {
+                fprintf(stderr, "Error: Out of memory while parsing.\n");
+                return -1;
+            }
+            add_redir(cmd, fd)->here = o;
+            for (; *w; w++) {
+                if (*w != GLOB_MARK) *o++ = *w;
+            }
+            *o++ = '\n';
+            *o = '\0';
+        } else if (is_empty(tl->toks[j + 1].text)) {
+            fprintf(stderr, "Error: Invalid filename after '%s'.\n", op);
+            return -1;
+        } else {
+            r = add_redir(cmd, fd);
+            r->file = tl->toks[j + 1].text;
+            r->append = type == TOK_APPEND || type == TOK_ERR_APPEND;
+        }
+        j++;
+    }
+
+    cmd->args[cmd->num_args] = NULL;
+    if (cmd->num_args == 0) {
+        fprintf(stderr, "Error: Empty Command.\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int is_pipe(token_type_t type) {
+    return type == TOK_PIPE || type == TOK_PIPE_ERR;
+}
+
+// Builds one pipeline from toks[start, end), which holds no list operators.
+// Commands and argv arrays come from the same arena as the tokens.
+static int parse_pipeline(arena_t *a, const token_list_t *tl, int start, int end,
+                          pipeline_t *pl) {
+    int num_cmds = 1;
+    int i;
+
+    pl->cmds = NULL;
+    pl->num_cmds = 0;
+    pl->background = 0;
+    pl->timed = TIME_NONE;
+    pl->memo = 0;
+    pl->sched = NULL;
+
+    // Leading `time [-m]`, `memo` and `sched ...` apply to the whole pipeline
+    while (start < end && tl->toks[start].type == TOK_WORD) {
+        const char *word = tl->toks[start].text;
+        int n;
+        if (strcmp(word, "time") == 0 && pl->timed == TIME_NONE) {
+            pl->timed = TIME_HUMAN;
+            start++;
+            if (start < end && tl->toks[start].type == TOK_WORD &&
+                strcmp(tl->toks[start].text, "-m") == 0) {
+                pl->timed = TIME_MACHINE;
+                start++;
+            }
+        } else if (strcmp(word, "memo") == 0 && !pl->memo) {
+            pl->memo = 1;
+            start++;
+        } else if (strcmp(word, "sched") == 0 && !pl->sched) {
+            if ((n = parse_sched(a, tl, start, end, &pl->sched)) < 0) return -1;
+            start += n;
+        } else {
+            break;
+        }
+    }
+    if (start == end) {
+        fprintf(stderr, "Error: Empty Command.\n");
+        return -1;
+    }
+
+    for (i = start; i < end; i++) {
+        if (!is_pipe(tl->toks[i].type)) continue;
+        if (i == start || i == end - 1 || is_pipe(tl->toks[i - 1].type)) break;
+        num_cmds++;
+    }
+    if (i < end) {
+        fprintf(stderr, "Error: Invalid pipeline syntax.\n");
+        return -1;
+    }
+
+    pl->cmds = (command_t *)arena_alloc(a, (size_t)num_cmds * sizeof(command_t));
+    if (!pl->cmds) {
+        fprintf(stderr, "Error: Out of memory while parsing.\n");
+        return -1;
+    }
+
+    for (i = start; i <= end; i++) {
+        command_t *cmd = &pl->cmds[pl->num_cmds];
+        sched_t *sched = NULL;
+        int n = 0;
+
+        if (i < end && !is_pipe(tl->toks[i].type)) continue;
+        // A stage's own `sched` overrides the pipeline's for that stage
+        if (tl->toks[start].type == TOK_WORD && strcmp(tl->toks[start].text, "sched") == 0 &&
+            (n = parse_sched(a, tl, start, i, &sched)) < 0) {
+            pl->num_cmds = 0;
+            return -1;
+        }
+        if (parse_command(a, tl, start + n, i, cmd) != 0) {
+            pl->num_cmds = 0;
+            return -1;
+        }
+        cmd->sched = sched;
+        if (i < end && tl->toks[i].type == TOK_PIPE_ERR) {
+            // Same as a 2>&1 after the stage's other redirections
+            if (find_redir(cmd, STDERR_FILENO)) {
+                fprintf(stderr, "Error: Multiple error redirections not allowed.\n");
+                pl->num_cmds = 0;
+                return -1;
+            }
+            add_redir(cmd, STDERR_FILENO)->dup = STDOUT_FILENO;
+        }
+        pl->num_cmds++;
+        start = i + 1;
+    }
+    return 0;
+}
+
+// Syntax tree of a command list; it only lives while the plan is laid out
+typedef struct list_node {
+    token_type_t op;            // TOK_SEMI, TOK_AND_IF or TOK_OR_IF; TOK_WORD for a pipeline
+    struct list_node *left;
+    struct list_node *right;
+    int first;                  // Step of the leftmost pipeline
+    int start;                  // Pipeline: its tokens
+    int end;
+    int background;
+} list_node_t;
+
+typedef struct {
+    arena_t *a;
+    const token_list_t *tl;
+    int pos;                    // Next token
+    int depth;                  // Open parentheses
+    list_node_t **leaves;       // Pipelines in source order, one per step
+    int nleaves;
+    int cap;
+} list_parser_t;
+
+static void syntax_error(const list_parser_t *p) {
+    if (p->pos < p->tl->count) {
+        fprintf(stderr, "Error: Syntax error near '%s'.\n",
+                token_name(p->tl->toks[p->pos].type));
+    } else {
+        fprintf(stderr, "Error: Syntax error at end of line.\n");
+    }
+}
+
+static list_node_t *list_node(list_parser_t *p, token_type_t op) {
+    list_node_t *n = (list_node_t *)arena_alloc(p->a, sizeof(*n));
+    if (!n) {
+        fprintf(stderr, "Error: Out of memory while parsing.\n");
+        return NULL;
+    }
+    memset(n, 0, sizeof(*n));
+    n->op = op;
+    return n;
+}
+
+static list_node_t *join_nodes(list_parser_t *p, token_type_t op, list_node_t *l, list_node_t *r) {
+    list_node_t *n = list_node(p, op);
+    if (!n) return NULL;
+    n->left = l;
+    n->right = r;
+    n->first = l->first;
+    return n;
+}
+
+static int is_list_op(token_type_t type) {
+    return type == TOK_AMP || type == TOK_SEMI || type == TOK_AND_IF ||
+           type == TOK_OR_IF || type == TOK_LPAREN || type == TOK_RPAREN;
+}
+
+static list_node_t *parse_list(list_parser_t *p);
+
+// A pipeline, or a ( list ) group
+static list_node_t *parse_unit(list_parser_t *p) {
+    const token_list_t *tl = p->tl;
+    list_node_t *n;
+
+    if (p->pos < tl->count && tl->toks[p->pos].type == TOK_LPAREN) {
+        if (++p->depth > MAX_GROUP_DEPTH) {
+            fprintf(stderr, "Error: Too many nested groups (limit %d).\n", MAX_GROUP_DEPTH);
+            return NULL;
+        }
+        p->pos++;
+        if (!(n = parse_list(p))) return NULL;
+        if (p->pos == tl->count) {
+            fprintf(stderr, "Error: Missing closing parenthesis.\n");
+            return NULL;
+        }
+        p->pos++;
+        p->depth--;
+        return n;
+    }
+
+    if (p->pos == tl->count || is_list_op(tl->toks[p->pos].type)) {
+        syntax_error(p);
+        return NULL;
+    }
+    if (!(n = list_node(p, TOK_WORD))) return NULL;
+    n->start = p->pos;
+    while (p->pos < tl->count && !is_list_op(tl->toks[p->pos].type)) p->pos++;
+    n->end = p->pos;
+
+    if (p->nleaves == p->cap) {
+        int cap = p->cap ? p->cap * 2 : 8;
+        list_node_t **grown = (list_node_t **)arena_alloc(p->a, (size_t)cap * sizeof(*grown));
+        if (!grown) {
+            fprintf(stderr, "Error: Out of memory while parsing.\n");
+            return NULL;
+        }
+        if (p->nleaves > 0) memcpy(grown, p->leaves, (size_t)p->nleaves * sizeof(*grown));
+        p->leaves = grown;
+        p->cap = cap;
+    }
+    n->first = p->nleaves;
+    p->leaves[p->nleaves++] = n;
+    return n;
+}
+
+// Units joined by && and ||, which bind left to right with equal precedence
+static list_node_t *parse_and_or(list_parser_t *p) {
+    list_node_t *n = parse_unit(p);
+
+    while (n && p->pos < p->tl->count) {
+        token_type_t op = p->tl->toks[p->pos].type;
+        list_node_t *r;
+        if (op != TOK_AND_IF && op != TOK_OR_IF) break;
+        p->pos++;
+        if (!(r = parse_unit(p))) return NULL;
+        n = join_nodes(p, op, n, r);
+    }
+    return n;
+}
+
+// And-or lists separated by ; or &, up to a ')' or the end of the line.
+// '&' puts the pipeline before it in the background; a whole && or ||
+// chain cannot be, since it would need a subshell to run it.
+static list_node_t *parse_list(list_parser_t *p) {
+    list_node_t *n = parse_and_or(p);
+    list_node_t *last = n;
+
+    while (n && p->pos < p->tl->count) {
+        token_type_t op = p->tl->toks[p->pos].type;
+
+        if (op == TOK_RPAREN) {
+            if (p->depth > 0) break;
+            syntax_error(p);
+            return NULL;
+        }
+        if (op != TOK_SEMI && op != TOK_AMP) {
+            syntax_error(p);
+            return NULL;
+        }
+        if (op == TOK_AMP) {
+            // Only a bare pipeline ends right before the '&'
+            if (last->op != TOK_WORD || last->end != p->pos) {
+                fprintf(stderr, "Error: Only a single pipeline can run in the background.\n");
+                return NULL;
+            }
+            last->background = 1;
+        }
+        // A separator may end the list
+        if (++p->pos == p->tl->count || p->tl->toks[p->pos].type == TOK_RPAREN) break;
+        if (!(last = parse_and_or(p))) return NULL;
+        n = join_nodes(p, TOK_SEMI, n, last);
+    }
+    return n;
+}
+
+// Points every step in the subtree n at its successors: ok after status
+// 0, fail otherwise. Left spines are walked in a loop, since long ; and
+// && chains nest to the left.
+static void layout_steps(plan_t *plan, const list_node_t *n, int ok, int fail) {
+    while (n->op != TOK_WORD) {
+        int next = n->right->first;
+        layout_steps(plan, n->right, ok, fail);
+        if (n->op == TOK_AND_IF) {
+            ok = next;
+        } else if (n->op == TOK_OR_IF) {
+            fail = next;
+        } else {
+            ok = fail = next;
+        }
+        n = n->left;
+    }
+    plan->steps[n->first].on_success = ok;
+    plan->steps[n->first].on_failure = fail;
+}
+
+// Parser: compiles the whole line into a plan once. Each pipeline
+// becomes a step that knows which step follows on success and on
+// failure, so running the line never looks at tokens again and skipped
+// branches cost nothing.
+int parse_line(arena_t *a, const char *input, const token_list_t *tl, plan_t *plan) {
+    list_parser_t p;
+    list_node_t *root;
+
+    plan->steps = NULL;
+    plan->num_steps = 0;
+    if (tl->count == 0) return 0;
+
+    memset(&p, 0, sizeof(p));
+    p.a = a;
+    p.tl = tl;
+    if (!(root = parse_list(&p))) return -1;
+
+    plan->steps = (plan_step_t *)arena_alloc(a, (size_t)p.nleaves * sizeof(plan_step_t));
+    if (!plan->steps) {
+        fprintf(stderr, "Error: Out of memory while parsing.\n");
+        return -1;
+    }
+    for (int i = 0; i < p.nleaves; i++) {
+        const list_node_t *leaf = p.leaves[i];
+        plan_step_t *step = &plan->steps[i];
+        int from = tl->toks[leaf->start].start;
+        int to = tl->toks[leaf->end - 1].end;
+        char *text;
+
+        if (parse_pipeline(a, tl, leaf->start, leaf->end, &step->pipeline) != 0) return -1;
+        step->pipeline.background = leaf->background;
+        text = (char *)arena_alloc(a, (size_t)(to - from) + 1);
+        if (!text) {
+            fprintf(stderr, "Error: Out of memory while parsing.\n");
+            return -1;
+        }
+        memcpy(text, input + from, (size_t)(to - from));
+        text[to - from] = '\0';
+        step->cmdline = text;
+    }
+    layout_steps(plan, root, p.nleaves, p.nleaves);
+    plan->num_steps = p.nleaves;
+    return 0;
+}
@@ -0,0 +1,173 @@
+// Cache of resolved command paths, behind the `hash` builtin
+
+#include "shell.h"
+
+#include <sys/stat.h>
+
+// Remembered location of a command, as shown by `hash`
+typedef struct path_entry {
+    struct path_entry *next;
+    char *name;
+    char *path;
+    int hits;
+} path_entry_t;
+
+static path_entry_t *path_cache[PATH_CACHE_BUCKETS];
+static char *path_cache_path;   // $PATH the cache was filled under
+
+// FNV-1a, used for the command path cache
+static unsigned long hash_string(const char *s) {
+    unsigned long h = 2166136261UL;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+// Empties the command path cache
+void path_cache_clear(void) {
+    int i;
+    for (i = 0; i < PATH_CACHE_BUCKETS; i++) {
+        path_entry_t *e = path_cache[i];
+        while (e) {
+            path_entry_t *next = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            e = next;
+        }
+        path_cache[i] = NULL;
+    }
+}
+
+// Drops one command from the cache
+void path_cache_forget(const char *name) {
+    path_entry_t **pp = &path_cache[hash_string(name) % PATH_CACHE_BUCKETS];
+    while (*pp) {
+        path_entry_t *e = *pp;
+        if (strcmp(e->name, name) == 0) {
+            *pp = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            return;
+        }
+        pp = &e->next;
+    }
+}
+
+// Walks $PATH once for name; returns a malloc'd path or NULL.
+// *relative is set when the hit came from a relative PATH entry.
+static char *search_path(const char *name, int *relative) {
+    const char *path = getenv("PATH");
+    size_t nlen = strlen(name);
+    const char *dir;
+
+    if (!path) path = DEFAULT_PATH;
+    for (dir = path; ; ) {
+        const char *end = strchr(dir, ':');
+        size_t dlen = end ? (size_t)(end - dir) : strlen(dir);
+        char *full = (char *)malloc(dlen + nlen + 3);
+        struct stat st;
+
+        if (!full) return NULL;
+        if (dlen == 0) {
+            memcpy(full, ".", 1);
+            dlen = 1;
+        } else {
+            memcpy(full, dir, dlen);
+        }
+        full[dlen] = '/';
+        memcpy(full + dlen + 1, name, nlen + 1);
+
+        if (stat(full, &st) == 0 && S_ISREG(st.st_mode) && access(full, X_OK) == 0) {
+            *relative = full[0] != '/';
+            return full;
+        }
+        free(full);
+
+        if (!end) break;
+        dir = end + 1;
+    }
+    return NULL;
+}
+
+// Resolves a command name through the cache, filling it on a miss.
+// Names with a slash, and names PATH cannot find, are left to exec.
+const char *path_cache_lookup(const char *name) {
+    const char *path = getenv("PATH");
+    path_entry_t **bucket;
+    path_entry_t *e;
+    char *found;
+    int relative = 0;
+
+    if (name[0] == '\0' || strchr(name, '/')) return NULL;
+
+    // Any change to PATH invalidates every entry
+    if (!path) path = DEFAULT_PATH;
+    if (!path_cache_path || strcmp(path_cache_path, path) != 0) {
+        path_cache_clear();
+        free(path_cache_path);
+        path_cache_path = strdup(path);
+        if (!path_cache_path) return NULL;
+    }
+
+    bucket = &path_cache[hash_string(name) % PATH_CACHE_BUCKETS];
+    for (e = *bucket; e; e = e->next) {
+        if (strcmp(e->name, name) == 0) {
+            e->hits++;
+            return e->path;
+        }
+    }
+
+    found = search_path(name, &relative);
+    if (!found) return NULL;
+    // Relative hits depend on the cwd, so they are never remembered
+    if (relative) {
+        free(found);
+        return NULL;
+    }
+
+    e = (path_entry_t *)malloc(sizeof(*e));
+    if (!e || !(e->name = strdup(name))) {
+        free(e);
+        free(found);
+        return NULL;
+    }
+    e->path = found;
+    e->hits = 1;
+    e->next = *bucket;
+    *bucket = e;
+    return e->path;
+}
+
+// Called when exec of a cached path failed; forgets it if it is gone
+void path_cache_check(const command_t *cmd) {
+    if (cmd->path && access(cmd->path, X_OK) != 0) {
+        path_cache_forget(cmd->args[0]);
+    }
+}
+
+// Prints the cache for `hash`; returns how many entries there were
+int path_cache_list(void) {
+    int shown = 0;
+
+    for (int i = 0; i < PATH_CACHE_BUCKETS; i++) {
+        for (path_entry_t *e = path_cache[i]; e; e = e->next) {
+            if (!shown++) printf("hits\tcommand\n");
+            printf("%4d\t%s\n", e->hits, e->path);
+        }
+    }
+    return shown;
+}
+
+// Re-resolves name so `hash name` also refreshes a stale entry; returns
+// -1 if it is not on PATH
+int path_cache_rehash(const char *name) {
+    path_cache_forget(name);
+    if (!path_cache_lookup(name)) return -1;
+    // Fresh entries sit at the head of their bucket
+    path_cache[hash_string(name) % PATH_CACHE_BUCKETS]->hits = 0;
+    return 0;
+}
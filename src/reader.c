@@ -0,0 +1,139 @@
+// Chunked line reader for the prompt, scripts and -c strings
+
+#include "shell.h"
+
+// Reads the next line into the reader's buffer and NUL-terminates it in
+// place. Lines may be any length; input is pulled in READ_CHUNK_SIZE reads.
+// Returns 1 with *line set, 0 at end of input, -1 on a read error.
+int read_line(line_reader_t *r, char **line) {
+    size_t scanned = r->start;
+
+    for (;;) {
+        char *nl = NULL;
+        ssize_t n;
+
+        if (r->end > scanned) nl = (char *)memchr(r->buf + scanned, '\n', r->end - scanned);
+        if (nl) {
+            *nl = '\0';
+            *line = r->buf + r->start;
+            r->start = (size_t)(nl - r->buf) + 1;
+            return 1;
+        }
+        scanned = r->end;
+
+        if (r->eof) {
+            // Final line without a trailing newline
+            if (r->start == r->end) return 0;
+            if (r->end == r->cap) {
+                char *grown = (char *)realloc(r->buf, r->cap + 1);
+                if (!grown) return -1;
+                r->buf = grown;
+                r->cap++;
+            }
+            r->buf[r->end] = '\0';
+            *line = r->buf + r->start;
+            r->start = r->end;
+            return 1;
+        }
+
+        // Slide the partial line down, then grow if it fills the buffer
+        if (r->start > 0) {
+            memmove(r->buf, r->buf + r->start, r->end - r->start);
+            r->end -= r->start;
+            scanned -= r->start;
+            r->start = 0;
+        }
+        if (r->cap - r->end < READ_CHUNK_SIZE) {
+            size_t cap = r->cap ? r->cap * 2 : READ_CHUNK_SIZE;
+            char *grown;
+            while (cap - r->end < READ_CHUNK_SIZE) cap *= 2;
+            grown = (char *)realloc(r->buf, cap);
+            if (!grown) return -1;
+            r->buf = grown;
+            r->cap = cap;
+        }
+
+        n = read(r->fd, r->buf + r->end, r->cap - r->end);
+        if (n < 0) return -1;
+        if (n == 0) r->eof = 1;
+        r->end += (size_t)n;
+    }
+}
+
+// Appends len bytes of s to the joined text at *used, NUL-terminated
+static int join_text(line_reader_t *r, size_t *used, const char *s, size_t len) {
+    if (*used + len + 1 > r->joined_cap) {
+        size_t cap = r->joined_cap ? r->joined_cap : READ_CHUNK_SIZE;
+        char *grown;
+        while (*used + len + 1 > cap) cap *= 2;
+        if (!(grown = (char *)realloc(r->joined, cap))) return -1;
+        r->joined = grown;
+        r->joined_cap = cap;
+    }
+    memcpy(r->joined + *used, s, len);
+    *used += len;
+    r->joined[*used] = '\0';
+    return 0;
+}
+
+// Reads the next command: one line or, if it opens << here-documents,
+// the line and every line up to the last delimiter, joined by newlines.
+// Same returns as read_line.
+int read_command(line_reader_t *r, char **text) {
+    char **delims;
+    char *line;
+    size_t used = 0;
+    int rc = read_line(r, text);
+    int n, k = 0;
+
+    if (rc <= 0 || !strstr(*text, "<<")) return rc;
+    if ((n = heredoc_delimiters(*text, &delims)) <= 0) return n < 0 ? -1 : rc;
+
+    // Lines read after this one may move the reader's buffer
+    if (join_text(r, &used, *text, strlen(*text)) != 0) rc = -1;
+    while (rc > 0 && k < n && (rc = read_line(r, &line)) > 0) {
+        if (join_text(r, &used, "\n", 1) != 0 || join_text(r, &used, line, strlen(line)) != 0) {
+            rc = -1;
+        } else if (strcmp(line, delims[k]) == 0) {
+            k++;
+        }
+    }
+    for (int i = 0; i < n; i++) free(delims[i]);
+    free(delims);
+    if (rc < 0) return -1;
+    // A missing delimiter is reported when the text is lexed
+    *text = r->joined;
+    return 1;
+}
+
+ms_reader_t *ms_reader_fd(int fd) {
+    ms_reader_t *r = (ms_reader_t *)calloc(1, sizeof(ms_reader_t));
+    if (!r) return NULL;
+    r->fd = fd;
+    return r;
+}
+
+ms_reader_t *ms_reader_string(char *text) {
+    ms_reader_t *r = (ms_reader_t *)calloc(1, sizeof(ms_reader_t));
+    if (!r) return NULL;
+    r->fd = -1;
+    r->buf = text;
+    r->end = strlen(text);
+    r->cap = r->end + 1;
+    r->eof = 1;
+    return r;
+}
+
+int ms_read_line(ms_reader_t *r, char **line) {
+    return read_command(r, line);
+}
+
+void ms_reader_close(ms_reader_t *r) {
+    if (!r) return;
+    if (r->fd >= 0) {
+        close(r->fd);
+        free(r->buf);
+    }
+    free(r->joined);
+    free(r);
+}
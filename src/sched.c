@@ -0,0 +1,257 @@
+// Stage scheduling: `sched` prefixes and the affinity option set CPU
+// affinity, niceness and I/O priority, which each stage applies to
+// itself between fork and exec
+
+#include "shell.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+
+// ioprio_set(2) has no glibc wrapper or header
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_RT 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+
+int affinity_mode;      // set -o affinity=spread: every pipeline spreads
+
+// One CPU the shell may run on, with where it sits in the machine
+typedef struct {
+    int cpu;
+    int thread;         // 0 for the first hardware thread of its core
+    int node;
+    int package;
+    int core;           // First CPU of the core, shared by its threads
+} cpu_place_t;
+
+static int *spread_order;       // CPUs in the order stages are placed on
+static int spread_count;
+static int spread_next;         // Where the next spread pipeline starts
+
+// First number in a sysfs file such as "3" or a list such as "2-3,10"
+static int read_sys_int(const char *path, int fallback) {
+    FILE *f = fopen(path, "re");
+    int v;
+
+    if (!f) return fallback;
+    if (fscanf(f, "%d", &v) != 1) v = fallback;
+    fclose(f);
+    return v;
+}
+
+// NUMA node of cpu: sysfs links it as cpuN/nodeM
+static int cpu_node(int cpu) {
+    char path[64];
+    struct dirent *de;
+    DIR *dp;
+    int node = 0;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    if (!(dp = opendir(path))) return 0;
+    while ((de = readdir(dp)) != NULL) {
+        if (strncmp(de->d_name, "node", 4) == 0 && isdigit((unsigned char)de->d_name[4])) {
+            node = atoi(de->d_name + 4);
+            break;
+        }
+    }
+    closedir(dp);
+    return node;
+}
+
+static int compare_places(const void *a, const void *b) {
+    const cpu_place_t *x = (const cpu_place_t *)a;
+    const cpu_place_t *y = (const cpu_place_t *)b;
+
+    if (x->thread != y->thread) return x->thread - y->thread;
+    if (x->node != y->node) return x->node - y->node;
+    if (x->package != y->package) return x->package - y->package;
+    if (x->core != y->core) return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+// Orders the CPUs the shell may use so that consecutive stages go to
+// neighbouring physical cores: one thread of every core first, grouped
+// by NUMA node and package, then the SMT siblings. Read from /sys once.
+static int load_spread_order(void) {
+    cpu_set_t allowed;
+    cpu_place_t *places;
+    int n = 0;
+
+    if (spread_order) return 0;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return -1;
+    places = (cpu_place_t *)malloc((size_t)CPU_COUNT(&allowed) * sizeof(cpu_place_t));
+    spread_order = (int *)malloc((size_t)CPU_COUNT(&allowed) * sizeof(int));
+    if (!places || !spread_order) {
+        free(places);
+        free(spread_order);
+        spread_order = NULL;
+        return -1;
+    }
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        char path[96];
+        cpu_place_t *p = &places[n];
+
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        p->cpu = cpu;
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+        p->core = read_sys_int(path, cpu);
+        p->thread = p->core != cpu;
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        p->package = read_sys_int(path, 0);
+        p->node = cpu_node(cpu);
+        n++;
+    }
+    qsort(places, (size_t)n, sizeof(cpu_place_t), compare_places);
+    for (int i = 0; i < n; i++) spread_order[i] = places[i].cpu;
+    spread_count = n;
+    free(places);
+    return 0;
+}
+
+// Reserves places in the spread order for a pipeline of n stages and
+// returns the first. Each pipeline starts where the one before ended, so
+// -j slots and background jobs running together get different CPUs
+// instead of all piling onto the first ones.
+int sched_spread_base(int n) {
+    int base;
+
+    if (load_spread_order() != 0 || spread_count == 0) return 0;
+    base = spread_next;
+    spread_next = (int)(((long)spread_next + n) % spread_count);
+    return base;
+}
+
+// CPU at place i of the spread order, wrapping round when there are more
+// stages than CPUs; -1 if the topology cannot be read
+int sched_spread_cpu(int i) {
+    if (load_spread_order() != 0 || spread_count == 0) return -1;
+    return spread_order[i % spread_count];
+}
+
+// Parses a CPU list such as "0-3,8" into set. Returns -1 if it is bad.
+static int parse_cpus(const char *s, cpu_set_t *set) {
+    CPU_ZERO(set);
+    do {
+        char *end;
+        long lo = strtol(s, &end, 10);
+        long hi = lo;
+
+        if (end == s || lo < 0) return -1;
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+            if (end == s) return -1;
+        }
+        if (hi < lo || hi >= CPU_SETSIZE) return -1;
+        for (long c = lo; c <= hi; c++) CPU_SET(c, set);
+        s = end;
+    } while (*s++ == ',');
+    return s[-1] == '\0' ? 0 : -1;
+}
+
+// Parses "idle", "be[:level]" or "rt[:level]" into an ioprio_set value
+static int parse_ioprio(const char *s, int *ioprio) {
+    int cls, level = 4;
+    size_t n = strcspn(s, ":");
+
+    if (n == 4 && strncmp(s, "idle", 4) == 0 && !s[n]) {
+        *ioprio = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+        return 0;
+    }
+    if (n == 2 && strncmp(s, "be", 2) == 0) cls = IOPRIO_CLASS_BE;
+    else if (n == 2 && strncmp(s, "rt", 2) == 0) cls = IOPRIO_CLASS_RT;
+    else return -1;
+    if (s[n] == ':') {
+        if (s[n + 1] < '0' || s[n + 1] > '7' || s[n + 2]) return -1;
+        level = s[n + 1] - '0';
+    } else if (s[n]) {
+        return -1;
+    }
+    *ioprio = cls << IOPRIO_CLASS_SHIFT | level;
+    return 0;
+}
+
+// Parses the `sched` prefix at toks[start], which must be the word
+// "sched", up to the command it applies to. Returns the number of
+// tokens it took, or -1 after reporting an error.
+int parse_sched(arena_t *a, const token_list_t *tl, int start, int end, sched_t **out) {
+    sched_t *s = (sched_t *)arena_alloc(a, sizeof(*s));
+    int j = start + 1;
+
+    if (!s) {
+        fprintf(stderr, "Error: Out of memory while parsing.\n");
+        return -1;
+    }
+    memset(s, 0, sizeof(*s));
+    for (; j < end && tl->toks[j].type == TOK_WORD && tl->toks[j].text[0] == '-'; j += 2) {
+        const char *opt = tl->toks[j].text;
+        const char *arg = j + 1 < end && tl->toks[j + 1].type == TOK_WORD ? tl->toks[j + 1].text
+                                                                          : NULL;
+        char *endp;
+
+        if (strcmp(opt, "--") == 0) {
+            j++;
+            break;
+        }
+        if (!arg || opt[1] == '\0' || opt[2] != '\0' || !strchr("cni", opt[1])) goto usage;
+        if (opt[1] == 'c' && strcmp(arg, "spread") == 0) {
+            s->spread = 1;
+            s->cpus = NULL;
+        } else if (opt[1] == 'c') {
+            s->cpus = (cpu_set_t *)arena_alloc(a, sizeof(cpu_set_t));
+            if (!s->cpus) {
+                fprintf(stderr, "Error: Out of memory while parsing.\n");
+                return -1;
+            }
+            if (parse_cpus(arg, s->cpus) != 0) {
+                fprintf(stderr, "Error: sched: Invalid CPU list '%s'.\n", arg);
+                return -1;
+            }
+            s->spread = 0;
+        } else if (opt[1] == 'n') {
+            long v = strtol(arg, &endp, 10);
+            if (endp == arg || *endp || v < -40 || v > 40) {
+                fprintf(stderr, "Error: sched: Invalid nice increment '%s'.\n", arg);
+                return -1;
+            }
+            s->nice = (int)v;
+            s->has_nice = 1;
+        } else if (parse_ioprio(arg, &s->ioprio) != 0) {
+            fprintf(stderr, "Error: sched: Invalid I/O priority '%s'.\n", arg);
+            return -1;
+        }
+    }
+    if (j >= end || tl->toks[j].type != TOK_WORD) goto usage;
+    *out = s;
+    return j - start;
+
+usage:
+    fprintf(stderr, "Error: sched: Usage: sched [-c cpus|spread] [-n nice] "
+            "[-i idle|be[:level]|rt[:level]] command.\n");
+    return -1;
+}
+
+// Child side, just before exec: applies s to the calling process. A
+// setting that cannot be applied is reported and the command runs anyway,
+// as with taskset and nice.
+void sched_apply(const sched_t *s) {
+    if (s->cpus && sched_setaffinity(0, sizeof(cpu_set_t), s->cpus) != 0) {
+        fprintf(stderr, "Error: sched_setaffinity() failed. %s.\n", strerror(errno));
+    }
+    if (s->has_nice) {
+        int prio;
+        errno = 0;
+        prio = getpriority(PRIO_PROCESS, 0);
+        if (errno == 0 && setpriority(PRIO_PROCESS, 0, prio + s->nice) != 0) {
+            fprintf(stderr, "Error: setpriority() failed. %s.\n", strerror(errno));
+        }
+    }
+    if (s->ioprio && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, s->ioprio) != 0) {
+        fprintf(stderr, "Error: ioprio_set() failed. %s.\n", strerror(errno));
+    }
+}
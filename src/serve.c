@@ -0,0 +1,465 @@
+// Daemon mode (--serve): runs command lines sent over a Unix socket
+
+#include "shell.h"
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Protocol, one request at a time per connection:
+//   client -> server  "command line\n", sent with up to three descriptors
+//                     (stdin, stdout, stderr) as SCM_RIGHTS ancillary data
+//   server -> client  "status N\n" once the line has finished
+// Descriptors the client leaves out are /dev/null. `exit` closes the
+// connection instead of stopping the server.
+
+#define SERVE_MAX_EVENTS 64
+#define SERVE_READ_SIZE 4096
+
+// One connected client and the request it is running, if any
+typedef struct client {
+    struct client *next;
+    int sock;
+    char *buf;          // Received bytes not yet consumed as requests
+    size_t len;
+    size_t cap;
+    int fds[3];         // Descriptors for the current request, -1 if absent
+    arena_t arena;      // Plan of the running request
+    plan_t plan;
+    int step;           // Step of the plan running or about to run
+    int status;         // Status of the last step run
+    job_t job;
+    int busy;           // A pipeline is running for this client
+    int closing;        // Drop once idle: hung up or sent `exit`
+} client_t;
+
+static client_t *clients;
+static int epoll_fd = -1;
+static int null_fd = -1;
+// Tags for the epoll entries that are not clients
+static int listen_tag;
+static int wakeup_tag;
+
+static void client_close_fds(client_t *c) {
+    for (int i = 0; i < 3; i++) {
+        if (c->fds[i] != -1) close(c->fds[i]);
+        c->fds[i] = -1;
+    }
+}
+
+static void client_drop(client_t *c) {
+    client_t **pp = &clients;
+    while (*pp && *pp != c) pp = &(*pp)->next;
+    if (*pp) *pp = c->next;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->sock, NULL);
+    close(c->sock);
+    client_close_fds(c);
+    arena_destroy(&c->arena);
+    free(c->buf);
+    free(c);
+}
+
+static void client_reply(client_t *c, int status) {
+    char msg[32];
+    int len = snprintf(msg, sizeof(msg), "status %d\n", status);
+    // Replies are tiny; a client that stopped reading is simply dropped
+    if (send(c->sock, msg, (size_t)len, MSG_NOSIGNAL) != len) c->closing = 1;
+}
+
+// Watches the client socket for requests only while it is idle
+static void client_watch(client_t *c, int readable) {
+    struct epoll_event ev;
+    ev.events = readable ? EPOLLIN : 0;
+    ev.data.ptr = c;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->sock, &ev);
+}
+
+// Points the server's stdout and stderr at the client's while the shell
+// works on its request, so builtins, `time` reports and every error
+// message along the way (syntax, expansion, redirections, exec) reach
+// the client instead of the server's log
+static void stdio_swap(const client_t *c, int saved[2]) {
+    fflush(stdout);
+    fflush(stderr);
+    saved[0] = dup(STDOUT_FILENO);
+    saved[1] = dup(STDERR_FILENO);
+    dup2(c->fds[1] != -1 ? c->fds[1] : null_fd, STDOUT_FILENO);
+    dup2(c->fds[2] != -1 ? c->fds[2] : null_fd, STDERR_FILENO);
+}
+
+static void stdio_restore(int saved[2]) {
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < 2; i++) {
+        if (saved[i] == -1) continue;
+        dup2(saved[i], STDOUT_FILENO + i);
+        close(saved[i]);
+    }
+}
+
+// Wraps up a finished request and reports its status
+static void client_finish(client_t *c, int status) {
+    client_close_fds(c);
+    arena_reset(&c->arena);
+    client_reply(c, status);
+    if (!c->closing) client_watch(c, 1);
+}
+
+// Records the status of the step just run and moves to the next one.
+// $? in the next step refers to it, as it would in a shell of its own.
+static void client_step_done(client_t *c, int status) {
+    const plan_step_t *step = &c->plan.steps[c->step];
+    last_status = c->status = status;
+    c->step = status == 0 ? step->on_success : step->on_failure;
+}
+
+// Runs the request's plan from its current step until a pipeline is left
+// running, which finishes from the event loop, or the plan is done.
+// Builtins run in the server with the client's output. Expansion runs
+// here too, so a $(...) blocks the loop until its command exits.
+static void client_advance(client_t *c) {
+    int saved[2];
+
+    stdio_swap(c, saved);
+    while (c->step < c->plan.num_steps) {
+        pipeline_t *pl = &c->plan.steps[c->step].pipeline;
+        int std_fds[3];
+        int status;
+
+        if (expand_pipeline(&c->arena, pl) != 0) {
+            client_step_done(c, 1);
+            continue;
+        }
+        if (pl->num_cmds == 1) {
+            if (strcmp(pl->cmds[0].args[0], "exit") == 0) {
+                c->closing = 1;
+                break;
+            }
+            if (run_builtin(&pl->cmds[0], &status)) {
+                set_pipe_status(&status, 1);
+                client_step_done(c, status);
+                continue;
+            }
+        }
+
+        for (int i = 0; i < 3; i++) std_fds[i] = c->fds[i] != -1 ? c->fds[i] : null_fd;
+        if (launch_pipeline(&c->arena, pl, std_fds, &c->job) != 0) {
+            client_step_done(c, 1);
+            continue;
+        }
+        if (c->job.nalive > 0) {
+            job_register(&c->job, 0);
+            c->busy = 1;
+            client_watch(c, 0);
+            stdio_restore(saved);
+            return;
+        }
+        if (pl->timed != TIME_NONE) report_times(&c->job);
+        set_pipe_status(c->job.statuses, pl->num_cmds);
+        client_step_done(c, job_result(&c->job));
+    }
+    stdio_restore(saved);
+    client_finish(c, c->status);
+}
+
+// Wraps up the running pipeline of a request and carries on with its plan
+static void client_job_done(client_t *c) {
+    job_unregister(&c->job);
+    c->busy = 0;
+    if (c->job.plan->timed != TIME_NONE) {
+        int saved[2];
+        stdio_swap(c, saved);
+        report_times(&c->job);
+        stdio_restore(saved);
+    }
+    set_pipe_status(c->job.statuses, c->job.plan->num_cmds);
+    client_step_done(c, job_result(&c->job));
+    client_advance(c);
+}
+
+// Starts one request line
+static void client_start(client_t *c, const char *line) {
+    token_list_t tokens;
+    int saved[2];
+    int rc;
+
+    stdio_swap(c, saved);
+    rc = lex_line(&c->arena, line, &tokens) != 0 ||
+         parse_line(&c->arena, line, &tokens, &c->plan) != 0;
+    stdio_restore(saved);
+    if (rc) {
+        client_finish(c, 2);
+        return;
+    }
+    c->step = 0;
+    c->status = 0;
+    client_advance(c);
+}
+
+// Runs buffered request lines until one starts a pipeline
+static void client_process(client_t *c) {
+    while (!c->busy && !c->closing) {
+        char *nl = c->len ? (char *)memchr(c->buf, '\n', c->len) : NULL;
+        size_t used;
+        if (!nl) break;
+        *nl = '\0';
+        used = (size_t)(nl - c->buf) + 1;
+        client_start(c, c->buf);
+        memmove(c->buf, c->buf + used, c->len - used);
+        c->len -= used;
+    }
+}
+
+// Reads request bytes and any descriptors that came with them
+static void client_read(client_t *c) {
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cm;
+    ssize_t n;
+
+    if (c->cap - c->len < SERVE_READ_SIZE) {
+        char *grown = (char *)realloc(c->buf, c->cap + SERVE_READ_SIZE);
+        if (!grown) {
+            c->closing = 1;
+            return;
+        }
+        c->buf = grown;
+        c->cap += SERVE_READ_SIZE;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = c->buf + c->len;
+    iov.iov_len = c->cap - c->len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    n = recvmsg(c->sock, &msg, MSG_CMSG_CLOEXEC);
+    if (n <= 0) {
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) return;
+        c->closing = 1;
+        return;
+    }
+    c->len += (size_t)n;
+
+    for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        int count, *fds;
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+        count = (int)((cm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        fds = (int *)CMSG_DATA(cm);
+        // A new set replaces whatever an earlier message left unused
+        client_close_fds(c);
+        for (int i = 0; i < count; i++) {
+            if (i < 3) c->fds[i] = fds[i];
+            else close(fds[i]);
+        }
+    }
+    if (msg.msg_flags & MSG_CTRUNC) c->closing = 1;
+
+    client_process(c);
+}
+
+static void accept_clients(int listen_fd) {
+    int sock;
+
+    while ((sock = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) != -1) {
+        client_t *c = (client_t *)calloc(1, sizeof(client_t));
+        struct epoll_event ev;
+
+        if (!c) {
+            close(sock);
+            continue;
+        }
+        c->sock = sock;
+        for (int i = 0; i < 3; i++) c->fds[i] = -1;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev) == -1) {
+            close(sock);
+            free(c);
+            continue;
+        }
+        c->next = clients;
+        clients = c;
+    }
+}
+
+// Reaps exited stages and answers every client whose pipeline is done
+static void finish_jobs(void) {
+    int status;
+    job_t *job;
+
+    child_exited = 0;
+    while (reap_child(WNOHANG, &status, &job) > 0) {}
+    for (client_t *c = clients; c; c = c->next) {
+        if (c->busy && c->job.nalive == 0) {
+            client_job_done(c);
+            client_process(c);
+        }
+    }
+}
+
+static int open_listener(const char *path) {
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Socket path '%s' is too long.\n", path);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+        fprintf(stderr, "Error: socket() failed. %s.\n", strerror(errno));
+        return -1;
+    }
+    // A socket file left by an earlier server would make bind fail
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, SOMAXCONN) == -1) {
+        fprintf(stderr, "Error: Cannot listen on '%s'. %s.\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int ms_serve(const char *path) {
+    struct epoll_event ev, events[SERVE_MAX_EVENTS];
+    int wake[2];
+    int listen_fd = open_listener(path);
+
+    if (listen_fd == -1) return EXIT_FAILURE;
+    null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (null_fd == -1 || epoll_fd == -1 || pipe2(wake, O_CLOEXEC | O_NONBLOCK) == -1) {
+        fprintf(stderr, "Error: Cannot set up the server. %s.\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    sigchld_wakeup = wake[1];
+    // Builtins, `time` reports and memo replays write to client fds from
+    // the server itself; a client that stops reading must not kill it.
+    // Stages and forked copies of the shell put SIGPIPE back.
+    signal(SIGPIPE, SIG_IGN);
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listen_tag;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.data.ptr = &wakeup_tag;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake[0], &ev);
+
+    // Runs until SIGINT
+    while (!interrupted) {
+        int n = epoll_wait(epoll_fd, events, SERVE_MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error: epoll_wait() failed. %s.\n", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            void *tag = events[i].data.ptr;
+            if (tag == &listen_tag) {
+                accept_clients(listen_fd);
+            } else if (tag == &wakeup_tag) {
+                char drain[64];
+                while (read(wake[0], drain, sizeof(drain)) > 0) {}
+                finish_jobs();
+            } else {
+                client_t *c = (client_t *)tag;
+                if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                    // Hangups are level-triggered; stop watching until the
+                    // running pipeline, if any, has been reaped
+                    c->closing = 1;
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->sock, NULL);
+                }
+                if (!c->busy && !c->closing && (events[i].events & EPOLLIN)) client_read(c);
+                // A client that went away still gets its pipeline reaped
+                if (c->closing && !c->busy) client_drop(c);
+            }
+        }
+        // SIGCHLD may have landed before the wakeup pipe existed
+        if (child_exited) finish_jobs();
+        for (client_t *c = clients, *next; c; c = next) {
+            next = c->next;
+            if (c->closing && !c->busy) client_drop(c);
+        }
+    }
+
+    while (clients) client_drop(clients);
+    sigchld_wakeup = -1;
+    close(wake[0]);
+    close(wake[1]);
+    close(listen_fd);
+    close(epoll_fd);
+    unlink(path);
+    signal(SIGPIPE, SIG_DFL);
+    return EXIT_SUCCESS;
+}
+
+int ms_connect(const char *path) {
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+int ms_remote_run(int sock, const char *line, const int std_fds[3]) {
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct msghdr msg;
+    struct iovec iov[2];
+    char reply[64];
+    size_t got = 0;
+    int status;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    iov[0].iov_base = (void *)line;
+    iov[0].iov_len = strlen(line);
+    iov[1].iov_base = (void *)"\n";
+    iov[1].iov_len = 1;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    if (std_fds) {
+        struct cmsghdr *cm;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(3 * sizeof(int));
+        memcpy(CMSG_DATA(cm), std_fds, 3 * sizeof(int));
+    }
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != (ssize_t)(iov[0].iov_len + 1)) return -1;
+
+    // Wait for the "status N" line
+    while (got < sizeof(reply) - 1) {
+        ssize_t n = read(sock, reply + got, sizeof(reply) - 1 - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        got += (size_t)n;
+        reply[got] = '\0';
+        if (strchr(reply, '\n')) break;
+    }
+    if (sscanf(reply, "status %d", &status) != 1) return -1;
+    return status;
+}
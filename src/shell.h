@@ -0,0 +1,387 @@
+// Internals shared by the modules of libminishell. Hosts use minishell.h.
+
+#ifndef SHELL_H
+#define SHELL_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#include "minishell.h"
+
+#define READ_CHUNK_SIZE (64 * 1024)
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+#define PATH_CACHE_BUCKETS 64
+#define VAR_TABLE_MIN 64        // Initial slots in the variable table
+#define DEFAULT_PATH "/bin:/usr/bin"
+#define FAST_DECLINE (-1)
+#define PARAM_MARK '\001'     // Lexer stand-in for a $ expanded when its pipeline runs
+#define GLOB_MARK '\002'      // Lexer prefix for an unquoted *, ? or [
+#define FIELD_MARK '\003'     // Splits a word where unquoted $(...) output had blanks
+#define ERRTAG_LINE_MAX 4096    // stderrtag: longer lines are split
+#define GLOB_CACHE_BUCKETS 64
+#define GLOB_CACHE_MAX 256      // Directory listings kept before the cache is flushed
+#define MAX_GROUP_DEPTH 256
+#define EXEC_ARG_HEADROOM 2048     // Slack left under ARG_MAX, as xargs does
+
+
+// One block of arena memory; data follows the header
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+} arena_chunk_t;
+
+// Bump allocator for everything that lives for one input line
+typedef struct {
+    arena_chunk_t *head;
+} arena_t;
+
+// Token kinds produced by the lexer
+typedef enum {
+    TOK_WORD,
+    TOK_PIPE,
+    TOK_PIPE_ERR,       // |&
+    TOK_IN,
+    TOK_HEREDOC,        // <<, its text the body that followed the line
+    TOK_HERESTR,        // <<<
+    TOK_OUT,
+    TOK_APPEND,
+    TOK_ERR_OUT,        // 2>
+    TOK_ERR_APPEND,     // 2>>
+    TOK_ERR_DUP,        // 2>&1
+    TOK_OUT_DUP,        // >&2 or 1>&2
+    TOK_FANOUT,         // >(...), its text the command line inside
+    TOK_AMP,
+    TOK_SEMI,
+    TOK_AND_IF,
+    TOK_OR_IF,
+    TOK_LPAREN,
+    TOK_RPAREN
+} token_type_t;
+
+typedef struct {
+    token_type_t type;
+    char *text;         // Unquoted word text, NULL for operators
+    int expand;         // Word holds PARAM_MARK or GLOB_MARK text to expand
+    int quoted;         // Word had quotes; keeps a here-document body literal
+    int start;          // Input span, for the source text of each pipeline
+    int end;
+} token_t;
+
+typedef struct {
+    token_t *toks;
+    int count;
+    int cap;
+} token_list_t;
+
+// In-process stage: runs argv against the given fds and returns an exit
+// status, or FAST_DECLINE to have the real program exec'd instead
+typedef int (*stage_fn_t)(char **argv, int in_fd, int out_fd);
+
+// Placement and priorities set by a `sched` prefix
+typedef struct {
+    cpu_set_t *cpus;    // -c list, NULL to keep the shell's
+    int spread;         // -c spread: one CPU per stage, see sched_spread_cpu
+    int nice;           // -n increment, relative like nice(1)
+    int has_nice;
+    int ioprio;         // -i as an ioprio_set value, 0 to keep the shell's
+} sched_t;
+
+// One redirection of a stage: fd is opened on file, fed here, or made
+// a copy of dup
+typedef struct {
+    int fd;             // STDIN_FILENO, STDOUT_FILENO or STDERR_FILENO
+    char *file;         // <, >, >>, 2> or 2>> target
+    char *here;         // << or <<< text
+    int append;
+    int dup;            // 2>&1, >&2 or |&: the fd copied, -1 for none
+} redir_t;
+
+// Description for each pipeline command
+typedef struct {
+    char **args;
+    int num_args;
+    unsigned char *quoted;  // Per word of args, while expand is set: it had
+                            // quotes, so it stays a word even if empty
+    redir_t redirs[3];  // In source order, at most one per fd
+    int num_redirs;
+    char **fanout;      // >(...) command lines that get a copy of stdout
+    int num_fanout;
+    const char *path;   // Resolved executable, NULL to let exec search PATH
+    stage_fn_t fast;    // Set when the stage runs without exec
+    int expand;         // Some word needs expand_pipeline before it runs
+    int split;          // xargs: argv too big for one exec, run in pieces
+    sched_t *sched;     // `sched` in front of this stage, NULL if none
+} command_t;
+
+// Report requested by a `time` prefix
+typedef enum {
+    TIME_NONE,
+    TIME_HUMAN,
+    TIME_MACHINE        // time -m: one JSON object per pipeline
+} time_mode_t;
+
+// One pipeline of a plan
+typedef struct {
+    command_t *cmds;
+    int num_cmds;
+    int background;     // Followed by '&'
+    time_mode_t timed;
+    int memo;           // `memo` prefix: output may come from the cache
+    sched_t *sched;     // `sched` in front of the pipeline, for every stage
+} pipeline_t;
+
+// A pipeline and where the plan goes once it has finished
+typedef struct {
+    pipeline_t pipeline;
+    const char *cmdline;    // Its source text, for `jobs`
+    int on_success;         // Next step after status 0; num_steps ends the plan
+    int on_failure;         // Next step after any other status
+} plan_step_t;
+
+// Parsed plan for one input line: its pipelines in source order, joined
+// by ;, &, && and || with ( ) grouping already resolved into jumps
+typedef struct {
+    plan_step_t *steps;
+    int num_steps;
+} plan_t;
+
+// Buffered line source for the prompt, scripts and -c strings
+typedef struct ms_reader {
+    int fd;             // -1 when reading from a string already in buf
+    char *buf;
+    size_t start;       // First unconsumed byte
+    size_t end;         // One past the last buffered byte
+    size_t cap;
+    int eof;
+    char *joined;       // A line and its here-document bodies
+    size_t joined_cap;
+} line_reader_t;
+
+// Descriptors a stage reads from and writes to; -1 keeps the shell's own
+typedef struct {
+    int in_fd;
+    int out_fd;
+    int err_fd;
+    int fds[3];         // What fds 0-2 become after its redirections, -1 to keep
+    int close_fd;       // Next stage's pipe end, closed by a child that never execs
+    pid_t pgid;         // Group to join, 0 to lead a new one, -1 for none
+    const sched_t *sched;   // Applied by the child before exec, NULL for none
+} stage_io_t;
+
+// Resources used by one stage, as reported by wait4, and when it ran;
+// kept for `time` and the trace log
+typedef struct {
+    pid_t pid;
+    int status;
+    struct rusage ru;
+    struct timespec spawned;    // CLOCK_REALTIME at launch
+    struct timespec started;    // CLOCK_MONOTONIC at launch
+    struct timespec reaped;     // CLOCK_MONOTONIC when it exited
+    long launch_ns;             // Time to start it; with spawn and vfork that includes exec
+} stage_usage_t;
+
+// memo: output of a pipeline being captured for the cache
+typedef struct {
+    int fd;             // Unnamed file in the cache directory
+    int out_fd;         // Where the output belongs, -1 for the shell's stdout
+    char *path;         // Cache entry it becomes if the pipeline succeeds
+    pid_t pid;          // Helper copying the output to out_fd and fd
+    int complete;       // The helper exited 0: fd holds all of the output
+} memo_capture_t;
+
+typedef struct errtag errtag_t;
+
+// A launched pipeline and the stages still to be reaped
+typedef struct job {
+    struct job *next;           // Job table link
+    int id;                     // Number shown by `jobs`, 0 if untracked
+    pid_t pgid;                 // Process group, 0 without job control
+    const pipeline_t *plan;
+    pid_t *pids;                // Per stage; -1 once reaped or if it never started
+    unsigned char *stopped;     // Per stage stop flags
+    int nprocs;                 // Entries in pids and stopped: the stages, then
+                                // with >(...) each stage's fan-out helper, or
+                                // memo's capture helper for the last one
+    int nalive;
+    int nstopped;
+    int background;
+    int term_sig;               // Signal that killed a stage, 0 if none
+    int *statuses;              // Per stage exit status, shell style (128+sig if killed)
+    int failed;                 // First stage that failed, -1 if none
+    int torn_down;              // failfast killed the remaining stages
+    memo_capture_t *memo;       // Capture to finish once the stages exit
+    errtag_t *errtag;           // stderrtag pipes still being drained, or NULL
+    int cached;                 // Output was replayed by memo, nothing ran
+    stage_usage_t *usage;       // Per stage, only for `time` and tracing
+    struct timespec started;
+    struct timespec finished;
+    const char *cmdline;
+    arena_t arena;              // Owns plan and cmdline once the job outlives its line
+} job_t;
+
+// How pipeline stages are started
+typedef enum {
+    LAUNCH_FORK,
+    LAUNCH_VFORK,
+    LAUNCH_SPAWN
+} launch_mode_t;
+
+
+// Builtins run inside the shell process
+typedef struct {
+    const char *name;
+    int (*fn)(const command_t *cmd);    // Returns the exit status
+} builtin_t;
+
+// Entry in the table behind `set -o`
+typedef struct {
+    const char *name;
+    int *value;
+    const char *const *choices;     // Allowed values, indexed by *value; NULL for a size
+} shell_option_t;
+
+
+// api.c
+extern volatile sig_atomic_t interrupted;
+extern volatile sig_atomic_t child_exited;
+extern int sigchld_wakeup;
+extern int last_status;
+
+// arena.c
+void *arena_alloc(arena_t *a, size_t n);
+char *arena_buffer_grow(char *buf, size_t *cap, size_t need);
+void arena_buffer_free(char *buf);
+void arena_adopt(arena_t *a, char *buf, size_t cap);
+void arena_reset(arena_t *a);
+void arena_destroy(arena_t *a);
+
+// parser.c
+int lex_line(arena_t *a, const char *input, token_list_t *tl);
+int heredoc_delimiters(const char *line, char ***delims);
+int parse_line(arena_t *a, const char *input, const token_list_t *tl, plan_t *plan);
+
+// expand.c
+size_t param_length(const char *s);
+size_t subst_length(const char *s);
+int expand_pipeline(arena_t *a, pipeline_t *pl);
+
+// glob.c
+void glob_cache_clear(void);
+int glob_word(arena_t *a, const char *word, char ***matches);
+
+// var.c
+const char *var_lookup(const char *name, size_t len);
+int var_set(const char *name, const char *value, int export);
+void var_unset(const char *name);
+size_t var_name_length(const char *s);
+int var_print_exports(void);
+
+// pathcache.c
+void path_cache_clear(void);
+void path_cache_forget(const char *name);
+const char *path_cache_lookup(const char *name);
+void path_cache_check(const command_t *cmd);
+int path_cache_list(void);
+int path_cache_rehash(const char *name);
+
+// errtag.c
+extern int stderr_tag;
+errtag_t *errtag_open(arena_t *a, const pipeline_t *pl);
+int errtag_pipe(errtag_t *t, int i);
+int errtag_drain(errtag_t *t, int timeout, const sigset_t *mask);
+void errtag_close(errtag_t *t);
+
+// fanout.c
+pid_t launch_fanout(const command_t *cmd, int src_fd, int out_fd, const int *std_fds,
+                    const stage_io_t *io);
+
+// sched.c
+extern int affinity_mode;
+int parse_sched(arena_t *a, const token_list_t *tl, int start, int end, sched_t **out);
+int sched_spread_base(int n);
+int sched_spread_cpu(int i);
+void sched_apply(const sched_t *s);
+
+// fastpath.c
+extern int fastpath;
+stage_fn_t find_fast_stage(const char *name);
+int run_fast_inline(const command_t *cmd, stage_fn_t fn);
+int copy_fd(int in_fd, int out_fd);
+int write_all(int fd, const char *buf, size_t len);
+
+// memo.c
+int memo_begin(arena_t *a, const pipeline_t *pl, int out_fd, job_t *job);
+pid_t memo_tee(job_t *job, stage_io_t *io);
+void memo_end(job_t *job);
+
+// launch.c
+extern int launch_mode;
+extern int pipe_size;
+extern int pipe_granted;
+extern int pipe_direct;
+extern int xargs_split;
+int here_fd(const char *text);
+const redir_t *find_redir(const command_t *cmd, int fd);
+int open_redirections(const command_t *cmd, const int base[3], int fds[3], int opened[3]);
+void close_redirections(int opened[3]);
+int launch_pipeline(arena_t *a, pipeline_t *pl, const int *std_fds, job_t *job);
+
+// jobs.c
+extern job_t *job_table;
+extern int job_control;
+extern pid_t shell_pgid;
+extern struct termios shell_tmodes;
+extern int pipefail;
+extern int failfast;
+extern int *pipe_status;
+extern int pipe_status_count;
+void job_register(job_t *job, int tracked);
+void job_unregister(job_t *job);
+void job_free(job_t *job);
+pid_t reap_child(int options, int *status, job_t **job);
+void reap_jobs(void);
+void print_job(const job_t *job);
+double timespec_diff(const struct timespec *end, const struct timespec *start);
+double timeval_secs(const struct timeval *tv);
+void json_string(FILE *out, const char *s);
+void report_times(const job_t *job);
+int job_result(const job_t *job);
+void set_pipe_status(const int *statuses, int n);
+void notify_jobs(void);
+int foreground_job(job_t *job);
+int execute_pipeline(arena_t *a, const pipeline_t *plan, const char *cmdline);
+
+// trace.c
+extern int trace_fd;
+int trace_open(const char *path);
+void trace_job(const job_t *job);
+
+// builtins.c
+extern const char *const launch_names[];
+extern const char *const onoff_names[];
+extern const char *const affinity_names[];
+int set_option(const char *spec, int on);
+int is_builtin(const char *word);
+int run_builtin(const command_t *cmd, int *status);
+
+// reader.c
+int read_line(line_reader_t *r, char **line);
+int read_command(line_reader_t *r, char **text);
+
+// batch.c
+int run_batch(line_reader_t *reader, int njobs, int keep_order);
+
+#endif
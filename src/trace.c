@@ -0,0 +1,78 @@
+// Execution trace (--trace, $MINISHELL_TRACE): one JSON line per stage
+
+#include "shell.h"
+
+#include <fcntl.h>
+#include <sys/wait.h>
+
+int trace_fd = -1;              // Append-only log, -1 when tracing is off
+static long trace_seq;          // Pipelines traced by this shell so far
+
+// Starts appending records to path
+int trace_open(const char *path) {
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+
+    if (fd == -1) {
+        fprintf(stderr, "Error: Cannot open trace log '%s'. %s.\n", path, strerror(errno));
+        return -1;
+    }
+    if (trace_fd != -1) close(trace_fd);
+    trace_fd = fd;
+    return 0;
+}
+
+// File cmd redirects fd to, as "key": "path" or null
+static void json_file(FILE *out, const char *key, const command_t *cmd, int fd) {
+    const redir_t *r = find_redir(cmd, fd);
+
+    fprintf(out, ",\"%s\":", key);
+    if (r && r->file) json_string(out, r->file);
+    else fputs("null", out);
+}
+
+// Logs every stage of a finished job. The records are built in memory
+// and go out in one O_APPEND write, so pipelines from concurrent shells
+// sharing a log never interleave.
+void trace_job(const job_t *job) {
+    const pipeline_t *pl = job->plan;
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *out;
+
+    if (trace_fd == -1 || !job->usage) return;
+    out = open_memstream(&buf, &len);
+    if (!out) return;
+
+    trace_seq++;
+    for (int i = 0; i < pl->num_cmds; i++) {
+        const command_t *cmd = &pl->cmds[i];
+        const stage_usage_t *u = &job->usage[i];
+        const redir_t *out_redir = find_redir(cmd, STDOUT_FILENO);
+        int started = u->pid > 0;
+
+        fprintf(out, "{\"shell\":%d,\"seq\":%ld,\"stage\":%d,\"argv\":[",
+                (int)getpid(), trace_seq, i);
+        for (int j = 0; j < cmd->num_args; j++) {
+            if (j) fputc(',', out);
+            json_string(out, cmd->args[j]);
+        }
+        fprintf(out, "],\"pid\":%d,\"start\":%.6f,\"launch_us\":%.1f,\"status\":%d,"
+                "\"signal\":%d,\"wall\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"maxrss_kb\":%ld",
+                started ? (int)u->pid : -1,
+                (double)u->spawned.tv_sec + u->spawned.tv_nsec / 1e9,
+                u->launch_ns / 1e3, job->statuses[i],
+                started && WIFSIGNALED(u->status) ? WTERMSIG(u->status) : 0,
+                started ? timespec_diff(&u->reaped, &u->started) : 0.0,
+                timeval_secs(&u->ru.ru_utime), timeval_secs(&u->ru.ru_stime),
+                u->ru.ru_maxrss);
+        json_file(out, "in", cmd, STDIN_FILENO);
+        json_file(out, "out", cmd, STDOUT_FILENO);
+        json_file(out, "err", cmd, STDERR_FILENO);
+        fprintf(out, ",\"append\":%s,\"fast\":%s,\"cached\":%s}\n",
+                out_redir && out_redir->append ? "true" : "false", cmd->fast ? "true" : "false",
+                job->cached ? "true" : "false");
+    }
+    // Best effort: a full disk must not take the shell down
+    if (fclose(out) == 0) write(trace_fd, buf, len);
+    free(buf);
+}
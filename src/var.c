@@ -0,0 +1,270 @@
+// Shell variables: an open-addressing table of names, and the envp array
+// of the exported ones, which is patched in place as exports change and
+// handed to every child as is
+
+#include "shell.h"
+
+#include <ctype.h>
+
+extern char **environ;
+
+// One variable. Exported ones own a "NAME=value" string in env_array.
+typedef struct {
+    char *name;         // NULL for a never-used slot
+    char *value;        // NULL once unset: the slot is a tombstone
+    char *entry;        // env_array[env_index], or NULL
+    int env_index;      // -1 when not exported
+} var_t;
+
+static var_t *vars;
+static size_t var_cap;          // Power of two
+static size_t var_used;         // Slots with a name, tombstones included
+
+static char **env_array;        // NULL-terminated; environ points here
+static int env_count;
+static int env_cap;
+
+// FNV-1a over the len bytes of a name
+static size_t hash_name(const char *name, size_t len) {
+    size_t h = 2166136261U;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+// Slot holding name, or the empty slot where it would go. Tombstones are
+// skipped while probing; the first one seen is reused for an insert.
+static var_t *var_slot(const char *name, size_t len) {
+    size_t mask = var_cap - 1;
+    var_t *reuse = NULL;
+
+    for (size_t i = hash_name(name, len) & mask; ; i = (i + 1) & mask) {
+        var_t *v = &vars[i];
+        if (!v->name) return reuse ? reuse : v;
+        if (!v->value) {
+            if (!reuse) reuse = v;
+            continue;
+        }
+        if (strncmp(v->name, name, len) == 0 && v->name[len] == '\0') return v;
+    }
+}
+
+// Doubles the table when it is 3/4 full, dropping tombstones
+static int var_reserve(void) {
+    var_t *old = vars;
+    size_t old_cap = var_cap;
+
+    if ((var_used + 1) * 4 <= var_cap * 3) return 0;
+    var_cap = old_cap * 2;
+    vars = (var_t *)calloc(var_cap, sizeof(var_t));
+    if (!vars) {
+        vars = old;
+        var_cap = old_cap;
+        return -1;
+    }
+    var_used = 0;
+    for (size_t i = 0; i < old_cap; i++) {
+        var_t *v = &old[i];
+        if (!v->name) continue;
+        if (!v->value) {
+            free(v->name);
+            continue;
+        }
+        *var_slot(v->name, strlen(v->name)) = *v;
+        var_used++;
+    }
+    free(old);
+    return 0;
+}
+
+// Adds entry to the end of env_array, keeping it NULL-terminated
+static int env_append(var_t *v, char *entry) {
+    if (env_count + 1 >= env_cap) {
+        int cap = env_cap * 2;
+        char **grown = (char **)realloc(env_array, (size_t)cap * sizeof(char *));
+        if (!grown) return -1;
+        env_array = grown;
+        env_cap = cap;
+        environ = env_array;
+    }
+    v->env_index = env_count;
+    v->entry = entry;
+    env_array[env_count++] = entry;
+    env_array[env_count] = NULL;
+    return 0;
+}
+
+// Takes v out of env_array by moving the last entry into its place
+static void env_remove(var_t *v) {
+    int last = env_count - 1;
+
+    if (v->env_index < last) {
+        const char *moved = env_array[last];
+        var_t *m = var_slot(moved, strcspn(moved, "="));
+        env_array[v->env_index] = env_array[last];
+        m->env_index = v->env_index;
+    }
+    env_array[last] = NULL;
+    env_count--;
+    free(v->entry);
+    v->entry = NULL;
+    v->env_index = -1;
+}
+
+// "name=value" in a new string
+static char *make_entry(const char *name, const char *value) {
+    size_t nlen = strlen(name), vlen = strlen(value);
+    char *entry = (char *)malloc(nlen + vlen + 2);
+
+    if (!entry) return NULL;
+    memcpy(entry, name, nlen);
+    entry[nlen] = '=';
+    memcpy(entry + nlen + 1, value, vlen + 1);
+    return entry;
+}
+
+// Loads the inherited environment on first use. From then on environ is
+// env_array, so getenv, fork and exec all see the shell's exports.
+static int var_init(void) {
+    if (vars) return 0;
+    var_cap = VAR_TABLE_MIN;
+    env_cap = 64;
+    vars = (var_t *)calloc(var_cap, sizeof(var_t));
+    env_array = (char **)malloc((size_t)env_cap * sizeof(char *));
+    if (!vars || !env_array) goto oom;
+    env_array[0] = NULL;
+
+    for (char **e = environ; e && *e; e++) {
+        const char *eq = strchr(*e, '=');
+        size_t nlen;
+        var_t *v;
+
+        if (!eq || eq == *e) continue;
+        nlen = (size_t)(eq - *e);
+        if (var_reserve() != 0) goto oom;
+        v = var_slot(*e, nlen);
+        // Like getenv, the first of duplicate names wins
+        if (v->name && v->value) continue;
+        if (!v->name) var_used++;
+        free(v->name);
+        v->name = strndup(*e, nlen);
+        v->value = strdup(eq + 1);
+        if (!v->name || !v->value) goto oom;
+        if (env_append(v, strdup(*e)) != 0 || !v->entry) goto oom;
+    }
+    environ = env_array;
+    return 0;
+
+oom:
+    fprintf(stderr, "Error: Out of memory.\n");
+    return -1;
+}
+
+// Value of the variable named by the len bytes at name, or NULL
+const char *var_lookup(const char *name, size_t len) {
+    var_t *v;
+
+    if (var_init() != 0) return NULL;
+    v = var_slot(name, len);
+    return v->name ? v->value : NULL;
+}
+
+// Sets a variable, keeping its env entry current if it is exported
+int var_set(const char *name, const char *value, int export) {
+    var_t *v;
+    char *copy, *entry = NULL;
+
+    if (var_init() != 0 || var_reserve() != 0) goto oom;
+    v = var_slot(name, strlen(name));
+    if (!value) value = v->name && v->value ? v->value : "";
+    if (!(copy = strdup(value))) goto oom;
+    if ((export || (v->name && v->env_index >= 0)) && !(entry = make_entry(name, value))) {
+        free(copy);
+        goto oom;
+    }
+
+    if (!v->name || !v->value) {
+        // A new name, possibly in the tombstone of another one
+        char *owned = strdup(name);
+        if (!owned) {
+            free(copy);
+            free(entry);
+            goto oom;
+        }
+        if (!v->name) var_used++;
+        free(v->name);
+        v->name = owned;
+        v->entry = NULL;
+        v->env_index = -1;
+    }
+    free(v->value);
+    v->value = copy;
+
+    if (!entry) return 0;
+    if (v->env_index >= 0) {
+        // Same slot, new string: nothing else in envp moves
+        free(v->entry);
+        v->entry = entry;
+        env_array[v->env_index] = entry;
+        return 0;
+    }
+    if (env_append(v, entry) == 0) return 0;
+    free(entry);
+
+oom:
+    fprintf(stderr, "Error: Out of memory.\n");
+    return -1;
+}
+
+// Removes a variable, and its env entry if it had one
+void var_unset(const char *name) {
+    var_t *v;
+
+    if (var_init() != 0) return;
+    v = var_slot(name, strlen(name));
+    if (!v->name || !v->value) return;
+    if (v->env_index >= 0) env_remove(v);
+    free(v->value);
+    v->value = NULL;
+}
+
+// Length of the variable name at s, 0 if s does not start with one
+size_t var_name_length(const char *s) {
+    size_t n = 0;
+
+    if (!isalpha((unsigned char)s[0]) && s[0] != '_') return 0;
+    while (isalnum((unsigned char)s[n]) || s[n] == '_') n++;
+    return n;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Prints the exports as `export NAME='value'` lines, sorted by name
+int var_print_exports(void) {
+    char **sorted;
+
+    if (var_init() != 0) return -1;
+    sorted = (char **)malloc(((size_t)env_count + 1) * sizeof(char *));
+    if (!sorted) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return -1;
+    }
+    memcpy(sorted, env_array, (size_t)env_count * sizeof(char *));
+    qsort(sorted, (size_t)env_count, sizeof(char *), compare_entries);
+    for (int i = 0; i < env_count; i++) {
+        const char *eq = strchr(sorted[i], '=');
+        printf("export %.*s='", (int)(eq - sorted[i]), sorted[i]);
+        for (const char *p = eq + 1; *p; p++) {
+            if (*p == '\'') fputs("'\"'\"'", stdout);
+            else putchar(*p);
+        }
+        fputs("'\n", stdout);
+    }
+    fflush(stdout);
+    free(sorted);
+    return 0;
+}
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""Summarise a minishell trace log (--trace / $MINISHELL_TRACE).
+
+Groups the per-stage records by command and ranks the groups by total
+wall time, so the commands that dominate a slow run come first.
+
+    tools/trace_summary.py trace.jsonl [more.jsonl ...]
+    tools/trace_summary.py --by argv --top 20 < trace.jsonl
+"""
+
+import argparse
+import json
+import sys
+from collections import defaultdict
+
+
+def read_records(paths):
+    files = [open(p, encoding="utf-8", errors="replace") for p in paths] or [sys.stdin]
+    for f in files:
+        for lineno, line in enumerate(f, 1):
+            line = line.strip()
+            if not line:
+                continue
+            try:
+                yield json.loads(line)
+            except ValueError:
+                print(f"{f.name}:{lineno}: skipping bad record", file=sys.stderr)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("logs", nargs="*", help="trace logs; stdin if none")
+    ap.add_argument("--by", choices=("argv0", "argv"), default="argv0",
+                    help="group by program name (default) or full argv")
+    ap.add_argument("--top", type=int, default=0, help="show only the first N groups")
+    args = ap.parse_args()
+
+    groups = defaultdict(lambda: {"runs": 0, "failed": 0, "wall": 0.0, "max": 0.0,
+                                  "user": 0.0, "sys": 0.0, "launch_us": 0.0,
+                                  "cached": 0})
+    pipelines = set()
+    total_wall = 0.0
+    for r in read_records(args.logs):
+        argv = r.get("argv") or ["?"]
+        key = argv[0] if args.by == "argv0" else " ".join(argv)
+        g = groups[key]
+        g["runs"] += 1
+        g["failed"] += r.get("status", 0) != 0
+        g["cached"] += bool(r.get("cached"))
+        g["wall"] += r.get("wall", 0.0)
+        g["max"] = max(g["max"], r.get("wall", 0.0))
+        g["user"] += r.get("user", 0.0)
+        g["sys"] += r.get("sys", 0.0)
+        g["launch_us"] += r.get("launch_us", 0.0)
+        pipelines.add((r.get("shell"), r.get("seq")))
+        total_wall += r.get("wall", 0.0)
+
+    if not groups:
+        print("no records")
+        return 0
+
+    ranked = sorted(groups.items(), key=lambda kv: kv[1]["wall"], reverse=True)
+    if args.top > 0:
+        ranked = ranked[:args.top]
+
+    print(f"{len(pipelines)} pipelines, {sum(g['runs'] for g in groups.values())} stages, "
+          f"{total_wall:.3f}s stage wall time")
+    print(f"{'wall':>10} {'%':>5} {'runs':>6} {'fail':>5} {'cached':>6} {'mean':>9} "
+          f"{'max':>9} {'user':>9} {'sys':>9} {'launch':>9}  command")
+    for key, g in ranked:
+        share = 100.0 * g["wall"] / total_wall if total_wall else 0.0
+        print(f"{g['wall']:10.3f} {share:5.1f} {g['runs']:6d} {g['failed']:5d} "
+              f"{g['cached']:6d} {g['wall'] / g['runs']:9.4f} {g['max']:9.4f} "
+              f"{g['user']:9.3f} {g['sys']:9.3f} {g['launch_us'] / g['runs']:7.0f}us  {key}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())